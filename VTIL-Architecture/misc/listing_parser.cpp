@@ -0,0 +1,497 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "listing_parser.hpp"
+#include <algorithm>
+#include <charconv>
+#include <stdexcept>
+#include <optional>
+#include <memory>
+#include <vector>
+#include <vtil/io>
+#include <vtil/amd64>
+#include <vtil/arm64>
+#include "../arch/instruction_set.hpp"
+
+namespace vtil::debug
+{
+	// Throws an error describing the failure at the given line.
+	//
+	[[noreturn]] static void parse_error( size_t line, const char* reason, std::string_view text )
+	{
+		throw std::runtime_error( format::str( "Line %llu: %s ('%s').", line, reason, std::string{ text } ) );
+	}
+
+	// Skips whitespace and the terminal escape sequences emitted by the logger.
+	//
+	static void skip_blank( std::string_view& s )
+	{
+		while ( !s.empty() )
+		{
+			if ( s[ 0 ] == ' ' || s[ 0 ] == '\t' || s[ 0 ] == '\r' )
+			{
+				s.remove_prefix( 1 );
+			}
+			else if ( s[ 0 ] == '\x1b' )
+			{
+				size_t end = s.find( 'm' );
+				s.remove_prefix( end == std::string_view::npos ? s.size() : end + 1 );
+			}
+			else
+			{
+				break;
+			}
+		}
+	}
+
+	// Reads the next token, empty if none left.
+	//
+	static std::string_view next_token( std::string_view& s )
+	{
+		skip_blank( s );
+		size_t n = 0;
+		while ( n < s.size() && s[ n ] != ' ' && s[ n ] != '\t' && s[ n ] != '\r' && s[ n ] != '\x1b' )
+			n++;
+		std::string_view token = s.substr( 0, n );
+		s.remove_prefix( n );
+		return token;
+	}
+
+	// Skips the given prefix if the string starts with it.
+	//
+	static bool consume( std::string_view& s, std::string_view prefix )
+	{
+		if ( !s.starts_with( prefix ) )
+			return false;
+		s.remove_prefix( prefix.size() );
+		return true;
+	}
+
+	// Parses an optionally signed integer, if base is not given determines it from the 0x prefix.
+	//
+	template<typename T>
+	static bool parse_integer( std::string_view s, T& out, int base = 0 )
+	{
+		bool negative = consume( s, "-" );
+		if ( !negative ) consume( s, "+" );
+		if ( !base )
+			base = ( consume( s, "0x" ) || consume( s, "0X" ) ) ? 16 : 10;
+		if ( s.empty() )
+			return false;
+
+		uint64_t value;
+		auto [ptr, ec] = std::from_chars( s.data(), s.data() + s.size(), value, base );
+		if ( ec != std::errc{} || ptr != s.data() + s.size() )
+			return false;
+		out = T( negative ? ( 0 - value ) : value );
+		return true;
+	}
+
+	// Finds the instruction descriptor for the given mnemonic and the access size indicated by its suffix.
+	//
+	static const instruction_desc* lookup_instruction( std::string_view mnemonic, bitcnt_t& access_size )
+	{
+		using table_t = std::vector<std::pair<std::string_view, const instruction_desc*>>;
+		static const table_t table = [ ] ()
+		{
+			table_t table;
+			for ( const instruction_desc* desc : get_instruction_list() )
+				table.emplace_back( desc->name, desc );
+			std::sort( table.begin(), table.end(), [ ] ( auto& a, auto& b ) { return a.first < b.first; } );
+			return table;
+		}();
+
+		auto find = [ & ] ( std::string_view name ) -> const instruction_desc*
+		{
+			auto it = std::lower_bound( table.begin(), table.end(), name, [ ] ( auto& entry, std::string_view name ) { return entry.first < name; } );
+			return ( it != table.end() && it->first == name ) ? it->second : nullptr;
+		};
+
+		// Try stripping the size suffix first.
+		//
+		if ( mnemonic.size() > 1 )
+		{
+			for ( size_t n = 1; n != std::size( format::suffix_map ); n++ )
+			{
+				if ( format::suffix_map[ n ] && mnemonic.back() == format::suffix_map[ n ] )
+				{
+					if ( auto desc = find( mnemonic.substr( 0, mnemonic.size() - 1 ) ) )
+					{
+						access_size = bitcnt_t( n * 8 );
+						return desc;
+					}
+				}
+			}
+		}
+		access_size = 0;
+		return find( mnemonic );
+	}
+
+	// Finds the identifier of the physical register with the given name.
+	//
+	static std::optional<uint64_t> lookup_physical( std::string_view name, architecture_identifier arch )
+	{
+		using table_t = std::vector<std::pair<std::string_view, uint64_t>>;
+		auto build = [ ] ( auto& registers, auto&& name_of, uint32_t count )
+		{
+			table_t table;
+			for ( uint32_t id = 1; id != count; id++ )
+			{
+				if ( ( uint32_t ) registers.extend( id ) != id )
+					continue;
+				if ( const char* name = name_of( id ) )
+					table.emplace_back( name, id );
+			}
+			std::sort( table.begin(), table.end(), [ ] ( auto& a, auto& b ) { return a.first < b.first; } );
+			return table;
+		};
+
+		const table_t* table;
+		if ( arch == architecture_amd64 )
+		{
+			static const table_t amd64_table = build( amd64::registers, amd64::name, X86_REG_ENDING );
+			table = &amd64_table;
+		}
+		else
+		{
+			static const table_t arm64_table = build( arm64::registers, arm64::name, ARM64_REG_ENDING );
+			table = &arm64_table;
+		}
+
+		auto it = std::lower_bound( table->begin(), table->end(), name, [ ] ( auto& entry, std::string_view name ) { return entry.first < name; } );
+		if ( it != table->end() && it->first == name )
+			return it->second;
+		return std::nullopt;
+	}
+
+	// Parses a register, throws on failure.
+	//
+	static register_desc parse_register( std::string_view s, architecture_identifier arch, size_t line )
+	{
+		std::string_view text = s;
+
+		// Parse the prefix.
+		//
+		uint32_t flags = 0;
+		if ( consume( s, "?" ) )  flags |= register_volatile;
+		if ( consume( s, "&&" ) ) flags |= register_readonly;
+
+		// Parse the suffix.
+		//
+		size_t suffix_pos = s.find_first_of( "@:" );
+		std::string_view name = s.substr( 0, suffix_pos );
+		std::string_view suffix = suffix_pos == std::string_view::npos ? std::string_view{} : s.substr( suffix_pos );
+		bitcnt_t bit_offset = 0;
+		bitcnt_t bit_count = 64;
+		if ( consume( suffix, "@" ) )
+		{
+			size_t end = std::min( suffix.find( ':' ), suffix.size() );
+			if ( !parse_integer( suffix.substr( 0, end ), bit_offset, 10 ) )
+				parse_error( line, "Invalid register offset", text );
+			suffix.remove_prefix( end );
+		}
+		if ( consume( suffix, ":" ) )
+		{
+			if ( !parse_integer( suffix, bit_count, 10 ) )
+				parse_error( line, "Invalid register size", text );
+			suffix = {};
+		}
+		if ( !suffix.empty() )
+			parse_error( line, "Invalid register suffix", text );
+
+		// Parse the name.
+		//
+		uint64_t id = 0;
+		uint64_t architecture = 0;
+		auto numbered = [ & ] ( std::string_view prefix )
+		{
+			return name.size() > prefix.size() && name.starts_with( prefix ) && parse_integer( name.substr( prefix.size() ), id, 10 );
+		};
+
+		if ( numbered( "sr" ) )            flags |= register_internal;
+		else if ( name == "UD" )           flags |= register_undefined;
+		else if ( name == "$flags" )       flags |= register_physical | register_flags;
+		else if ( name == "$sp" )          flags |= register_physical | register_stack_pointer;
+		else if ( name == "base" )         flags |= register_image_base;
+		else if ( numbered( "t" ) )        flags |= register_local;
+		else if ( numbered( "vr" ) )       flags |= register_virtual;
+		else if ( auto physical = lookup_physical( name, arch ) )
+		{
+			flags |= register_physical;
+			id = *physical;
+			architecture = arch;
+		}
+		else
+		{
+			parse_error( line, "Unknown register", text );
+		}
+		return { flags, id, bit_count, bit_offset, architecture };
+	}
+
+	// Parses an instruction, throws on failure.
+	//
+	static instruction parse_instruction( std::string_view s, architecture_identifier arch, size_t line )
+	{
+		std::string_view text = s;
+		instruction ins;
+
+		// If the instruction is prefixed by the index as printed by debug::dump, parse 
+		// the VIP and the stack details before the mnemonic.
+		//
+		std::string_view token = next_token( s );
+		if ( token.size() > 1 && token.back() == ':' &&
+			 std::all_of( token.begin(), token.end() - 1, [ ] ( char c ) { return '0' <= c && c <= '9'; } ) )
+		{
+			// Parse the VIP.
+			//
+			skip_blank( s );
+			if ( !consume( s, "[ PSEUDO ]" ) )
+			{
+				size_t end = s.find( ']' );
+				if ( !consume( s, "[" ) || end == std::string_view::npos || !parse_integer( s.substr( 0, end - 1 ), ins.vip, 16 ) )
+					parse_error( line, "Invalid instruction VIP", text );
+				s.remove_prefix( end );
+			}
+
+			// Parse the stack index and the stack offset.
+			//
+			skip_blank( s );
+			if ( consume( s, "[" ) )
+			{
+				size_t end = s.find( ']' );
+				if ( end == std::string_view::npos || !parse_integer( s.substr( 0, end ), ins.sp_index, 10 ) )
+					parse_error( line, "Invalid stack index", text );
+				s.remove_prefix( end + 1 );
+			}
+			skip_blank( s );
+			ins.sp_reset = consume( s, ">" );
+			if ( !parse_integer( next_token( s ), ins.sp_offset ) )
+				parse_error( line, "Invalid stack offset", text );
+			token = next_token( s );
+		}
+
+		// Resolve the instruction.
+		//
+		bitcnt_t access_size;
+		ins.base = lookup_instruction( token, access_size );
+		if ( !ins.base )
+			parse_error( line, "Unknown instruction", text );
+
+		// Parse the operands.
+		//
+		ins.operands.reserve( ins.base->operand_count() );
+		while ( !( token = next_token( s ) ).empty() )
+		{
+			if ( ins.operands.size() == ins.base->operand_count() )
+				parse_error( line, "Too many operands", text );
+
+			operand& op = ins.operands.emplace_back();
+			if ( token[ 0 ] == '-' || token[ 0 ] == '+' || ( '0' <= token[ 0 ] && token[ 0 ] <= '9' ) )
+			{
+				operand::immediate_t imm;
+				if ( !parse_integer( token, imm.i64 ) )
+					parse_error( line, "Invalid immediate", token );
+				op.descriptor = imm;
+			}
+			else
+			{
+				op.descriptor = parse_register( token, arch, line );
+			}
+		}
+		if ( ins.operands.size() != ins.base->operand_count() )
+			parse_error( line, "Too few operands", text );
+
+		// Mnemonics of sizes without a suffix (e.g. booleans) are printed as is, in which case
+		// the access size can still be recovered from the register it is determined by.
+		//
+		if ( !access_size && ins.base->vaccess_size_index > 0 )
+		{
+			const operand& op = ins.operands[ ins.base->vaccess_size_index - 1 ];
+			if ( op.is_register() )
+				access_size = op.reg().bit_count;
+		}
+
+		// Size the immediates, memory offsets and branch destinations are always 64-bits, rest
+		// is assumed to be of the access size.
+		//
+		for ( size_t n = 0; n != ins.operands.size(); n++ )
+		{
+			operand& op = ins.operands[ n ];
+			if ( op.is_register() )
+				continue;
+
+			bool is_64 = !access_size;
+			is_64 |= ins.base->accesses_memory() && n == size_t( ins.base->memory_operand_index + 1 );
+			for ( auto& list : { ins.base->branch_operands_rip, ins.base->branch_operands_vip } )
+				is_64 |= std::find( list.begin(), list.end(), int( n ) ) != list.end();
+			op.imm().bit_count = is_64 ? 64 : access_size;
+		}
+
+		if ( !ins.is_valid() )
+			parse_error( line, "Invalid instruction", text );
+		return ins;
+	}
+
+	// Parses a single instruction.
+	//
+	instruction parse_instruction( std::string_view text, architecture_identifier arch )
+	{
+		return parse_instruction( text, arch, 1 );
+	}
+
+	// Parses a register in the format of register_desc::to_string.
+	//
+	register_desc parse_register( std::string_view text, architecture_identifier arch )
+	{
+		skip_blank( text );
+		return parse_register( next_token( text ), arch, 1 );
+	}
+
+	// Parses a listing into a new routine.
+	//
+	routine* parse_routine( std::string_view text, architecture_identifier arch )
+	{
+		std::unique_ptr<routine> rtn = std::make_unique<routine>( arch );
+
+		// Instructions of each block, current block is null if a block is listed again.
+		//
+		std::vector<std::pair<basic_block*, std::vector<instruction>>> blocks;
+		std::pair<basic_block*, std::vector<instruction>>* current = nullptr;
+		std::string_view comment = {};
+
+		size_t line_number = 0;
+		while ( !text.empty() )
+		{
+			// Fetch the next line.
+			//
+			size_t end = std::min( text.find( '\n' ), text.size() );
+			std::string_view s = text.substr( 0, end );
+			text.remove_prefix( std::min( end + 1, text.size() ) );
+			line_number++;
+
+			// Skip the padding.
+			//
+			do skip_blank( s );
+			while ( consume( s, "|" ) );
+			if ( s.empty() )
+				continue;
+
+			// Handle the block headers.
+			//
+			if ( consume( s, "Entry point VIP:" ) )
+			{
+				vip_t vip;
+				if ( !parse_integer( next_token( s ), vip ) )
+					parse_error( line_number, "Invalid block VIP", s );
+				auto [blk, inserted] = rtn->create_block( vip );
+				current = inserted ? &blocks.emplace_back( blk, std::vector<instruction>{} ) : nullptr;
+				continue;
+			}
+			if ( consume( s, "Stack pointer:" ) )
+			{
+				if ( current && !parse_integer( next_token( s ), current->first->sp_offset ) )
+					parse_error( line_number, "Invalid stack pointer", s );
+				continue;
+			}
+			if ( s.starts_with( "Already visited?:" ) || s.starts_with( "---" ) || s.starts_with( ";" ) )
+				continue;
+
+			// Save the comments to be attached to the next instruction.
+			//
+			if ( consume( s, "//" ) )
+			{
+				skip_blank( s );
+				while ( !s.empty() && ( s.back() == '\r' || s.back() == ' ' ) )
+					s.remove_suffix( 1 );
+				comment = s;
+				continue;
+			}
+
+			// Parse the instruction, if it is listed before any block, create a block at VIP 0.
+			//
+			if ( !current )
+			{
+				if ( !blocks.empty() )
+					parse_error( line_number, "Instruction listed outside of a block", s );
+				current = &blocks.emplace_back( rtn->create_block( 0 ).first, std::vector<instruction>{} );
+			}
+			instruction& ins = current->second.emplace_back( parse_instruction( s, arch, line_number ) );
+			if ( !comment.empty() )
+			{
+				ins.context.get<std::string>() = std::string{ comment };
+				comment = {};
+			}
+		}
+
+		// Assign the instructions and recover the block state.
+		//
+		uint64_t last_internal_id = 0;
+		for ( auto& [blk, list] : blocks )
+		{
+			for ( auto& ins : list )
+			{
+				for ( auto& op : ins.operands )
+				{
+					if ( !op.is_register() ) continue;
+					if ( op.reg().is_internal() )
+						last_internal_id = std::max( last_internal_id, op.reg().local_id + 1 );
+					else if ( op.reg().is_local() )
+						blk->last_temporary_index = std::max<uint32_t>( blk->last_temporary_index, op.reg().local_id + 1 );
+				}
+			}
+			if ( !list.empty() )
+				blk->sp_index = list.back().sp_index;
+			blk->assign( list.begin(), list.end() );
+		}
+		rtn->last_internal_id = last_internal_id;
+
+		// Link the blocks according to the immediate destinations of the branches.
+		//
+		for ( auto& [blk, list] : blocks )
+		{
+			if ( blk->empty() || !blk->back().base->is_branching_virt() )
+				continue;
+			for ( int idx : blk->back().base->branch_operands_vip )
+			{
+				const operand& op = blk->back().operands[ idx ];
+				if ( op.is_immediate() && rtn->explored_blocks.contains( op.imm().u64 ) )
+					rtn->create_block( op.imm().u64, blk );
+			}
+		}
+		if ( !rtn->entry_point )
+			throw std::runtime_error( "Listing contains no blocks." );
+		return rtn.release();
+	}
+
+	// Parses the listing in the given file.
+	//
+	routine* load_listing( const std::filesystem::path& path, architecture_identifier arch )
+	{
+		file::mapped_view view{ path };
+		return parse_routine( { ( const char* ) view.data(), view.size() }, arch );
+	}
+};
\ No newline at end of file
@@ -0,0 +1,63 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <string_view>
+#include <filesystem>
+#include "../arch/identifier.hpp"
+#include "../routine/routine.hpp"
+#include "../routine/basic_block.hpp"
+#include "../routine/instruction.hpp"
+
+// Parser for the textual listings produced by debug::dump and instruction::to_string.
+//
+namespace vtil::debug
+{
+	// Parses a single instruction in either of the forms below:
+	// - "movq     t0           0x1             " as produced by instruction::to_string.
+	// - "0001: [00001000] [1] >+0x8      movq t0 0x1" as printed by debug::dump.
+	//
+	// Since the listing does not include the size of immediates, they are sized according to the 
+	// access size of the instruction unless they are memory offsets or branch destinations which 
+	// are always 64-bits.
+	//
+	instruction parse_instruction( std::string_view text, architecture_identifier arch = architecture_amd64 );
+
+	// Parses a register in the format of register_desc::to_string.
+	//
+	register_desc parse_register( std::string_view text, architecture_identifier arch = architecture_amd64 );
+
+	// Parses a listing into a new routine. Blocks are started by the "Entry point VIP" headers, 
+	// instructions listed before any header are placed in a block at VIP 0. Block links are 
+	// recovered from the immediate destinations of the branch at the end of each block.
+	//
+	routine* parse_routine( std::string_view text, architecture_identifier arch = architecture_amd64 );
+
+	// Parses the listing in the given file.
+	//
+	routine* load_listing( const std::filesystem::path& path, architecture_identifier arch = architecture_amd64 );
+};
\ No newline at end of file
@@ -26,8 +26,11 @@
 // POSSIBILITY OF SUCH DAMAGE.        
 //
 #include "serialization.hpp"
+#include <vtil/utility>
 #include <algorithm>
+#include <deque>
 #include <stdexcept>
+#include <memory>
 
 #pragma warning(disable:4267)
 namespace vtil
@@ -38,14 +41,195 @@ namespace vtil
 		uint32_t magic_1 = 'LITV';
 		architecture_identifier arch_id;
 		uint8_t zero_pad = 0;				// Intentionally left zero to make sure non-binary streams fail.
-		uint16_t magic_2 = 0xDEAD;
+		uint16_t magic_2 = 0xDEAF;			// 0xDEAD for unversioned (version 0) files.
 	};
 	static_assert( sizeof( file_header ) == 8, "Invalid file header size." );
+
+	// Versioned files follow the file header with the extended header describing the chunks,
+	// each chunk is prefixed by a chunk header and is checksummed individually. First chunk 
+	// describes the routine, each following one describes a single basic block.
+	//
+	struct file_header_ext
+	{
+		uint16_t version = format_version;
+		uint16_t flags = 0;
+		uint32_t block_count = 0;
+		uint64_t instruction_count = 0;
+		uint32_t checksum = 0;				// CRC32-C of the fields above.
+	};
+	static_assert( sizeof( file_header_ext ) == 20, "Invalid extended file header size." );
+
+	struct chunk_header
+	{
+		uint32_t length = 0;
+		uint32_t checksum = 0;				// CRC32-C of the payload.
+	};
+	static_assert( sizeof( chunk_header ) == 8, "Invalid chunk header size." );
+
+	// Appendable files follow the extended header with the location of the index chunk,
+	// which is patched in-place after new chunks are appended.
+	//
+	struct index_locator
+	{
+		uint64_t offset = 0;
+		uint32_t checksum = 0;				// CRC32-C of the offset.
+	};
+	static_assert( sizeof( index_locator ) == 12, "Invalid index locator size." );
 #pragma pack(pop)
 
+	// Magic values used to identify the unversioned and the versioned formats.
+	//
+	static constexpr uint16_t magic_unversioned = 0xDEAD;
+	static constexpr uint16_t magic_versioned =   0xDEAF;
+
+	// Upper limit on the size of a single chunk, used to reject corrupted lengths before allocating.
+	//
+	static constexpr uint32_t max_chunk_length = 1u << 30;
+
+	// Offset of the first chunk in the appendable format.
+	//
+	static constexpr uint64_t appendable_header_length = sizeof( file_header ) + sizeof( file_header_ext ) + sizeof( index_locator );
+
+	// Fetches more data from the source so that at least [n] bytes are readable.
+	//
+	void byte_reader::refill( size_t n )
+	{
+		if ( !source )
+			throw std::out_of_range( "Reading past file end." );
+
+		// Move the bytes left to the beginning of the window and read the rest from the stream.
+		//
+		size_t left = limit - cursor;
+		if ( left && cursor != window.data() )
+			memmove( window.data(), cursor, left );
+		window.resize( n );
+		source->read( ( char* ) window.data() + left, n - left );
+		if ( size_t( source->gcount() ) != ( n - left ) )
+			throw std::out_of_range( "Reading past file end." );
+		cursor = window.data();
+		limit = cursor + n;
+	}
+
+	// Skips the next [n] bytes.
+	//
+	void byte_reader::skip( size_t n )
+	{
+		// Skip the buffered bytes first.
+		//
+		size_t buffered = std::min( n, remaining() );
+		cursor += buffered;
+		n -= buffered;
+		if ( !n ) return;
+
+		// Skip the rest in the source stream.
+		//
+		if ( !source )
+			throw std::out_of_range( "Reading past file end." );
+		source->ignore( n );
+		if ( size_t( source->gcount() ) != n )
+			throw std::out_of_range( "Reading past file end." );
+	}
+
+	// Number of bytes left in the input including the unread part of the source stream.
+	//
+	size_t byte_reader::available() const
+	{
+		if ( !source )
+			return remaining();
+
+		// Determine the length of the stream by seeking to its end.
+		//
+		auto pos = source->tellg();
+		if ( pos == std::istream::pos_type( -1 ) )
+			return SIZE_MAX;
+		source->seekg( 0, std::ios::end );
+		auto end = source->tellg();
+		source->seekg( pos );
+		if ( end == std::istream::pos_type( -1 ) || end < pos )
+			return SIZE_MAX;
+		return remaining() + size_t( end - pos );
+	}
+
+	// Calculates the checksum of the extended header.
+	//
+	static uint32_t checksum_header( const file_header_ext& hdr )
+	{
+		return crc32c( &hdr, offsetof( file_header_ext, checksum ) );
+	}
+
+	// Reads and validates the file headers, returns the version of the file.
+	//
+	static uint16_t read_headers( byte_reader& in, file_header& hdr, file_header_ext& ext )
+	{
+		// Read and validate the file header.
+		//
+		deserialize( in, hdr );
+		if ( hdr.magic_1 != file_header{}.magic_1 ||
+			 hdr.zero_pad != file_header{}.zero_pad ||
+			 ( hdr.magic_2 != magic_unversioned && hdr.magic_2 != magic_versioned ) )
+			throw std::runtime_error( "Invalid VTIL header." );
+
+		// If unversioned, there is no extended header.
+		//
+		if ( hdr.magic_2 == magic_unversioned )
+			return 0;
+
+		// Read and validate the extended header.
+		//
+		deserialize( in, ext );
+		if ( ext.checksum != checksum_header( ext ) )
+			throw std::runtime_error( "Header checksum mismatch." );
+		if ( ext.version == 0 || ext.version > format_version_appendable )
+			throw std::runtime_error( "Unsupported VTIL format version." );
+		return ext.version;
+	}
+
+	// Reads the header of the next chunk and validates its length.
+	//
+	static chunk_header read_chunk_header( byte_reader& in )
+	{
+		chunk_header chdr;
+		deserialize( in, chdr );
+		if ( chdr.length > max_chunk_length )
+			throw std::runtime_error( "Invalid chunk length." );
+		return chdr;
+	}
+
+	// Reads the next chunk and validates its checksum, returns a view of the payload.
+	//
+	static std::string_view read_chunk( byte_reader& in )
+	{
+		chunk_header chdr = read_chunk_header( in );
+		const char* payload = ( const char* ) in.view( chdr.length );
+		if ( crc32c( payload, chdr.length ) != chdr.checksum )
+			throw std::runtime_error( "Chunk checksum mismatch." );
+		return { payload, chdr.length };
+	}
+
+	// Writes a chunk with the payload emitted by the given callback in-place.
+	//
+	template<typename F>
+	static void write_chunk( byte_writer& out, F&& payload )
+	{
+		// Reserve space for the header and write the payload.
+		//
+		size_t offset = out.size();
+		out.write_fields( chunk_header{} );
+		payload();
+
+		// Fill the header.
+		//
+		size_t length = out.size() - offset - sizeof( chunk_header );
+		chunk_header chdr = {
+			.length = ( uint32_t ) length,
+			.checksum = crc32c( out.data() + offset + sizeof( chunk_header ), length )
+		};
+		memcpy( out.data() + offset, &chdr, sizeof( chunk_header ) );
+	}
+
 	// Serialization of VTIL calling conventions.
 	//
-	void serialize( std::ostream& out, const call_convention& in )
+	void serialize( byte_writer& out, const call_convention& in )
 	{
 		serialize( out, in.volatile_registers );
 		serialize( out, in.param_registers );
@@ -54,7 +238,7 @@ namespace vtil
 		serialize( out, in.shadow_space );
 		serialize( out, in.purge_stack );
 	}
-	void deserialize( std::istream& in, call_convention& out )
+	void deserialize( byte_reader& in, call_convention& out )
 	{
 		deserialize( in, out.volatile_registers );
 		deserialize( in, out.param_registers );
@@ -66,14 +250,11 @@ namespace vtil
 
 	// Serialization of VTIL blocks.
 	//
-	void serialize( std::ostream& out, const basic_block* in )
+	void serialize( byte_writer& out, const basic_block* in )
 	{
 		// Write rest of the properties as is.
 		//
-		serialize( out, in->entry_vip );
-		serialize( out, in->sp_offset );
-		serialize( out, in->sp_index );
-		serialize( out, in->last_temporary_index );
+		out.write_fields( in->entry_vip, in->sp_offset, in->sp_index, in->last_temporary_index );
 		serialize( out, *in );
 
 		// Write the entry VIP of each block reference instead of the pointer. 
@@ -86,28 +267,39 @@ namespace vtil
 		serialize( out, prev );
 		serialize( out, next );
 	}
-	void deserialize( std::istream& in, routine* rtn, basic_block*& blk )
+	static basic_block* deserialize_unlinked( byte_reader& in, routine* rtn, std::vector<vip_t>& prev, std::vector<vip_t>& next )
 	{
 		// Create a new block, read basic properties and bind to the owner
 		//
 		vip_t vip;
-		deserialize( in, vip );
-		blk = new basic_block( rtn, vip );
-		deserialize( in, blk->sp_offset );
-		deserialize( in, blk->sp_index );
-		deserialize( in, blk->last_temporary_index );
+		int64_t sp_offset;
+		uint32_t sp_index;
+		uint32_t last_temporary_index;
+		in.read_fields( vip, sp_offset, sp_index, last_temporary_index );
+		basic_block*& entry = rtn->explored_blocks[ vip ];
+		if ( entry )
+			throw std::runtime_error( "Duplicate block." );
+		basic_block* blk = entry = new basic_block( rtn, vip );
+		blk->sp_offset = sp_offset;
+		blk->sp_index = sp_index;
+		blk->last_temporary_index = last_temporary_index;
 		std::vector<instruction> list;
 		deserialize( in, list );
 		blk->assign( list.begin(), list.end() );
-		blk->owner = rtn;
-		blk->owner->explored_blocks[ blk->entry_vip ] = blk;
 
 		// Read referenced VIP's.
 		//
-		std::vector<vip_t> prev;
-		std::vector<vip_t> next;
 		deserialize( in, prev );
 		deserialize( in, next );
+		return blk;
+	}
+	void deserialize( byte_reader& in, routine* rtn, basic_block*& blk )
+	{
+		// Read the block and the referenced VIP's.
+		//
+		std::vector<vip_t> prev;
+		std::vector<vip_t> next;
+		blk = deserialize_unlinked( in, rtn, prev, next );
 
 		// Resolve each reference.
 		//
@@ -131,20 +323,11 @@ namespace vtil
 		std::transform( next.begin(), next.end(), std::back_inserter( blk->next ), ref_resolve );
 	}
 
-	// Serialization of VTIL routines.
+	// Serialization of the routine properties, namely the entry point and the calling conventions.
 	//
-	void serialize( std::ostream& out, const routine* rtn )
+	static void serialize_properties( byte_writer& out, const routine* rtn )
 	{
-		// Write the file header.
-		//
-		serialize( out, file_header{ .arch_id = rtn->arch_id } );
-
-		// Write the entry point VIP.
-		//
 		serialize( out, rtn->entry_point->entry_vip );
-
-		// Write the call conventions used.
-		//
 		serialize( out, rtn->routine_convention );
 		serialize( out, rtn->subroutine_convention );
 		serialize<clength_t>( out, rtn->spec_subroutine_conventions.size() );
@@ -153,30 +336,122 @@ namespace vtil
 			serialize( out, k );
 			serialize( out, v );
 		}
+	}
+	static vip_t deserialize_properties( byte_reader& in, routine* rtn )
+	{
+		vip_t entry_vip;
+		deserialize( in, entry_vip );
+		deserialize( in, rtn->routine_convention );
+		deserialize( in, rtn->subroutine_convention );
+
+		clength_t num_convs;
+		deserialize( in, num_convs );
+		while ( num_convs-- > 0 )
+		{
+			vip_t k; call_convention v;
+			deserialize( in, k ); deserialize( in, v );
+			rtn->spec_subroutine_conventions[ k ] = v;
+		}
+		return entry_vip;
+	}
+
+	// Invokes the callback with a reader for the given chunk, rejects the chunk unless it is fully consumed.
+	//
+	template<typename F>
+	static void read_from( std::string_view chunk, F&& fn )
+	{
+		byte_reader in{ chunk.data(), chunk.size() };
+		fn( in );
+		if ( in.remaining() )
+			throw std::runtime_error( "Unexpected data in chunk." );
+	}
+
+	// Resolves the block references read by deserialize_unlinked.
+	//
+	static void link_blocks( routine* rtn, const std::vector<basic_block*>& blocks, const std::vector<std::pair<std::vector<vip_t>, std::vector<vip_t>>>& links )
+	{
+		auto ref_resolve = [ & ] ( vip_t vip )
+		{
+			auto it = rtn->explored_blocks.find( vip );
+			if ( it == rtn->explored_blocks.end() )
+				throw std::runtime_error( "Failed resolving block reference." );
+			return it->second;
+		};
+		for ( size_t n = 0; n != blocks.size(); n++ )
+		{
+			std::transform( links[ n ].first.begin(), links[ n ].first.end(), std::back_inserter( blocks[ n ]->prev ), ref_resolve );
+			std::transform( links[ n ].second.begin(), links[ n ].second.end(), std::back_inserter( blocks[ n ]->next ), ref_resolve );
+		}
+	}
+
+	// Serialization of VTIL routines.
+	//
+	void serialize( byte_writer& out, const routine* rtn )
+	{
+		// Write the file headers.
+		//
+		file_header_ext ext = {
+			.block_count = ( uint32_t ) rtn->num_blocks(),
+			.instruction_count = rtn->num_instructions()
+		};
+		ext.checksum = checksum_header( ext );
+		serialize( out, file_header{ .arch_id = rtn->arch_id } );
+		serialize( out, ext );
 
-		// Write the number of blocks we will serialize.
+		// Write the routine chunk.
 		//
-		serialize<clength_t>( out, rtn->num_blocks() );
+		write_chunk( out, [ & ] () { serialize_properties( out, rtn ); } );
 
-		// Dump all blocks in cached order.
+		// Write a chunk for each block in cached order.
 		//
 		for ( auto& pair : rtn->explored_blocks )
-			serialize( out, pair.second );
+			write_chunk( out, [ & ] () { serialize( out, pair.second ); } );
 	}
-	void deserialize( std::istream& in, routine*& rtn )
+
+	// Finalizes a deserialized routine.
+	//
+	static void finalize_routine( routine* rtn, vip_t entry_vip )
 	{
-		// Read and validate the file header.
+		// Assign the fetched entry point from cache.
 		//
-		file_header hdr;
-		deserialize( in, hdr );
-		if ( hdr.magic_1 != file_header{}.magic_1 ||
-			 hdr.zero_pad != file_header{}.zero_pad ||
-			 hdr.magic_2 != file_header{}.magic_2 )
-			throw std::runtime_error( "Invalid VTIL header." );
+		auto it = rtn->explored_blocks.find( entry_vip );
+		if ( it == rtn->explored_blocks.end() || !it->second )
+			throw std::runtime_error( "Failed resolving entry point." );
+		rtn->entry_point = it->second;
 
+		// Determine last internal id.
+		//
+		uint64_t last_internal_id = 0;
+		for ( auto& [v, block] : rtn->explored_blocks )
+		{
+			for ( auto& ins : *block )
+			{
+				for ( auto& op : ins.operands )
+				{
+					if ( op.is_register() && op.reg().is_internal() )
+					{
+						last_internal_id = std::max( 
+							last_internal_id, 
+							op.reg().local_id + 1 
+						);
+					}
+				}
+			}
+		}
+		rtn->last_internal_id = last_internal_id;
+
+		// Flush paths.
+		//
+		rtn->flush_paths();
+	}
+
+	// Deserialization of the unversioned format.
+	//
+	static routine* deserialize_v0( byte_reader& in, const file_header& hdr )
+	{
 		// Create a new routine.
 		//
-		rtn = new routine( hdr.arch_id );
+		std::unique_ptr<routine> rtn = std::make_unique<routine>( hdr.arch_id );
 
 		// Read the entry point VIP.
 		//
@@ -190,7 +465,7 @@ namespace vtil
 
 		clength_t num_convs;
 		deserialize( in, num_convs );
-		while ( rtn->spec_subroutine_conventions.size() != num_convs )
+		while ( rtn->spec_subroutine_conventions.size() != size_t( num_convs ) )
 		{
 			vip_t k; call_convention v;
 			deserialize( in, k ); deserialize( in, v );
@@ -202,47 +477,408 @@ namespace vtil
 		//
 		clength_t num_blocks;
 		deserialize( in, num_blocks );
-		while ( rtn->num_blocks() != num_blocks )
+		while ( rtn->num_blocks() != size_t( num_blocks ) )
 		{
 			basic_block* tmp;
-			deserialize( in, rtn, tmp );
+			deserialize( in, rtn.get(), tmp );
 		}
 
-		// Assign the fetched entry point from cache and return.
+		// Finalize and return.
 		//
-		rtn->entry_point = rtn->explored_blocks[ entry_vip ];
-		if ( !rtn->entry_point )
-			throw std::runtime_error( "Failed resolving entry point." );
+		finalize_routine( rtn.get(), entry_vip );
+		return rtn.release();
+	}
 
-		// Determine last internal id.
+	// Deserialization of the versioned format.
+	//
+	static routine* deserialize_v1( byte_reader& in, const file_header& hdr, const file_header_ext& ext )
+	{
+		// Reject block counts that cannot fit in the rest of the input before allocating, if the
+		// length of the input is not known, grow the chunk list as the chunks are read instead.
 		//
-		uint64_t last_internal_id = 0;
-		for ( auto& [v, block] : rtn->explored_blocks )
+		size_t available = in.available();
+		if ( ext.block_count >= available / sizeof( chunk_header ) )
+			throw std::runtime_error( "Invalid block count." );
+
+		// Read every chunk and validate the checksums before constructing anything, if the
+		// reader is not backed by stable memory, copy the payloads since views get invalidated.
+		//
+		size_t chunk_count = size_t( ext.block_count ) + 1;
+		std::vector<std::string_view> chunks;
+		std::deque<std::string> copies;
+		if ( available != SIZE_MAX )
+			chunks.reserve( chunk_count );
+		while ( chunks.size() != chunk_count )
 		{
-			for ( auto& ins : *block )
+			auto& chunk = chunks.emplace_back( read_chunk( in ) );
+			if ( !in.is_stable() )
+				chunk = copies.emplace_back( chunk );
+		}
+
+		// Create a new routine.
+		//
+		std::unique_ptr<routine> rtn = std::make_unique<routine>( hdr.arch_id );
+
+		// Read the entry point VIP and the call conventions used.
+		//
+		vip_t entry_vip;
+		read_from( chunks[ 0 ], [ & ] ( byte_reader& rin ) { entry_vip = deserialize_properties( rin, rtn.get() ); } );
+
+		// Read each block without resolving the references.
+		//
+		std::vector<std::pair<std::vector<vip_t>, std::vector<vip_t>>> links( ext.block_count );
+		std::vector<basic_block*> blocks( ext.block_count );
+		for ( size_t n = 0; n != ext.block_count; n++ )
+		{
+			read_from( chunks[ n + 1 ], [ & ] ( byte_reader& bin )
 			{
-				for ( auto& op : ins.operands )
+				blocks[ n ] = deserialize_unlinked( bin, rtn.get(), links[ n ].first, links[ n ].second );
+			} );
+		}
+
+		// Resolve each reference, finalize and return.
+		//
+		link_blocks( rtn.get(), blocks, links );
+		finalize_routine( rtn.get(), entry_vip );
+		return rtn.release();
+	}
+
+	// Calculates the key identifying the serialized state of a block, block epoch does not cover
+	// changes to the links so they are hashed as well.
+	//
+	static hash_t block_key( const basic_block* blk )
+	{
+		hash_t key = make_hash( blk->epoch, blk->sp_offset, blk->sp_index, blk->last_temporary_index, blk->prev.size(), blk->next.size() );
+		for ( const basic_block* prev : blk->prev )
+			key = combine_hash( key, make_hash( prev->entry_vip ) );
+		for ( const basic_block* next : blk->next )
+			key = combine_hash( key, make_hash( next->entry_vip ) );
+		return key;
+	}
+
+	// Parsed view of an appendable file.
+	//
+	struct appendable_view
+	{
+		// Data following the headers, copied if the reader is not stable.
+		//
+		std::string_view region;
+		std::string copy;
+
+		// Index chunk, the blocks listed and the routine properties following them.
+		//
+		uint64_t index_offset = 0;
+		std::string_view index;
+		std::vector<std::pair<vip_t, uint64_t>> blocks;
+		std::string_view properties;
+
+		// Returns the chunk at the given file offset.
+		//
+		std::string_view chunk_at( uint64_t offset, bool verify_checksum = true ) const
+		{
+			if ( offset < appendable_header_length || ( offset - appendable_header_length ) > region.size() )
+				throw std::runtime_error( "Invalid chunk offset." );
+			size_t position = offset - appendable_header_length;
+			byte_reader in{ region.data() + position, region.size() - position };
+			if ( verify_checksum )
+				return read_chunk( in );
+			chunk_header chdr = read_chunk_header( in );
+			return { ( const char* ) in.view( chdr.length ), chdr.length };
+		}
+	};
+
+	// Reads the index locator and the index of an appendable file.
+	//
+	static void read_appendable( byte_reader& in, const file_header_ext& ext, appendable_view& view, bool verify_checksums = true )
+	{
+		// Read and validate the locator.
+		//
+		index_locator loc;
+		in.read_fields( loc );
+		if ( loc.checksum != crc32c( &loc.offset, sizeof( loc.offset ) ) )
+			throw std::runtime_error( "Header checksum mismatch." );
+
+		// Reference the rest of the data, copy it if the reader is not stable.
+		//
+		if ( in.is_stable() )
+		{
+			view.region = { ( const char* ) in.cursor, in.remaining() };
+			in.cursor = in.limit;
+		}
+		else
+		{
+			view.copy.assign( ( const char* ) in.cursor, in.remaining() );
+			view.copy.append( std::istreambuf_iterator<char>( *in.source ), {} );
+			in.cursor = in.limit;
+			view.region = view.copy;
+		}
+
+		// Read the block list from the index, routine properties follow it.
+		//
+		view.index_offset = loc.offset;
+		view.index = view.chunk_at( loc.offset, verify_checksums );
+		byte_reader iin{ view.index.data(), view.index.size() };
+		clength_t num_blocks;
+		deserialize( iin, num_blocks );
+		if ( num_blocks < 0 || uint32_t( num_blocks ) != ext.block_count )
+			throw std::runtime_error( "Invalid block count." );
+		iin.require( num_blocks * ( sizeof( vip_t ) + sizeof( uint64_t ) ) );
+		view.blocks.resize( num_blocks );
+		for ( auto& [vip, offset] : view.blocks )
+			iin.read_fields( vip, offset );
+		view.properties = { ( const char* ) iin.cursor, iin.remaining() };
+	}
+
+	// Deserialization of the appendable format.
+	//
+	static routine* deserialize_v2( byte_reader& in, const file_header& hdr, const file_header_ext& ext )
+	{
+		// Read the index.
+		//
+		appendable_view view;
+		read_appendable( in, ext, view );
+
+		// Create a new routine and read the routine properties.
+		//
+		std::unique_ptr<routine> rtn = std::make_unique<routine>( hdr.arch_id );
+		vip_t entry_vip;
+		read_from( view.properties, [ & ] ( byte_reader& rin ) { entry_vip = deserialize_properties( rin, rtn.get() ); } );
+
+		// Read each block listed without resolving the references.
+		//
+		std::vector<std::pair<std::vector<vip_t>, std::vector<vip_t>>> links( view.blocks.size() );
+		std::vector<basic_block*> blocks( view.blocks.size() );
+		std::vector<uint32_t> lengths( view.blocks.size() );
+		for ( size_t n = 0; n != view.blocks.size(); n++ )
+		{
+			std::string_view chunk = view.chunk_at( view.blocks[ n ].second );
+			read_from( chunk, [ & ] ( byte_reader& bin )
+			{
+				blocks[ n ] = deserialize_unlinked( bin, rtn.get(), links[ n ].first, links[ n ].second );
+			} );
+			if ( blocks[ n ]->entry_vip != view.blocks[ n ].first )
+				throw std::runtime_error( "Index does not match the block." );
+			lengths[ n ] = sizeof( chunk_header ) + chunk.size();
+		}
+
+		// Resolve each reference and finalize.
+		//
+		link_blocks( rtn.get(), blocks, links );
+		finalize_routine( rtn.get(), entry_vip );
+
+		// Save the incremental serializer state so that saving the routine back to 
+		// the same file only appends the blocks modified after this point.
+		//
+		serialization_state& state = rtn->context.get<serialization_state>();
+		state.file_length = appendable_header_length + view.region.size();
+		state.index_offset = view.index_offset;
+		state.live_length = appendable_header_length + sizeof( chunk_header ) + view.index.size();
+		for ( size_t n = 0; n != blocks.size(); n++ )
+		{
+			state.blocks[ blocks[ n ]->entry_vip ] = { block_key( blocks[ n ] ), view.blocks[ n ].second, lengths[ n ] };
+			state.live_length += lengths[ n ];
+		}
+		return rtn.release();
+	}
+
+	void deserialize( byte_reader& in, routine*& rtn )
+	{
+		// Read and validate the file headers, redirect to the version specific reader.
+		//
+		file_header hdr;
+		file_header_ext ext;
+		switch ( read_headers( in, hdr, ext ) )
+		{
+			case 0:  rtn = deserialize_v0( in, hdr );      break;
+			case 1:  rtn = deserialize_v1( in, hdr, ext ); break;
+			default: rtn = deserialize_v2( in, hdr, ext ); break;
+		}
+	}
+
+	// Validates a serialized routine without decoding it.
+	//
+	routine_summary probe( byte_reader& in, bool verify_checksums )
+	{
+		routine_summary summary = {};
+		try
+		{
+			// Read and validate the file headers.
+			//
+			file_header hdr;
+			file_header_ext ext;
+			summary.version = read_headers( in, hdr, ext );
+			summary.arch_id = hdr.arch_id;
+			if ( summary.version == 0 )
+				throw std::runtime_error( "Unversioned file cannot be probed." );
+			summary.block_count = ext.block_count;
+			summary.instruction_count = ext.instruction_count;
+
+			// If appendable, walk the blocks listed in the index.
+			//
+			if ( summary.version == format_version_appendable )
+			{
+				appendable_view view;
+				read_appendable( in, ext, view, verify_checksums );
+				summary.byte_count = appendable_header_length + sizeof( chunk_header ) + view.index.size();
+				for ( auto& [vip, offset] : view.blocks )
+					summary.byte_count += sizeof( chunk_header ) + view.chunk_at( offset, verify_checksums ).size();
+				return summary;
+			}
+
+			// Walk each chunk, validating the checksums if requested.
+			//
+			summary.byte_count = sizeof( file_header ) + sizeof( file_header_ext );
+			for ( size_t n = 0; n <= ext.block_count; n++ )
+			{
+				if ( verify_checksums )
 				{
-					if ( op.is_register() && op.reg().is_internal() )
-					{
-						last_internal_id = std::max( 
-							last_internal_id, 
-							op.reg().local_id + 1 
-						);
-					}
+					summary.byte_count += sizeof( chunk_header ) + read_chunk( in ).size();
+				}
+				else
+				{
+					chunk_header chdr = read_chunk_header( in );
+					in.skip( chdr.length );
+					summary.byte_count += sizeof( chunk_header ) + chdr.length;
 				}
 			}
 		}
-		rtn->last_internal_id = last_internal_id;
+		catch ( const std::exception& ex )
+		{
+			summary.error = ex.what();
+		}
+		return summary;
+	}
 
-		// Flush paths.
+	// Saves the routine in the appendable format, appending only the modified blocks if possible.
+	//
+	incremental_save_result save_routine_incremental( const routine* rtn, const std::filesystem::path& path )
+	{
+		serialization_state& state = rtn->context.get<serialization_state>();
+		incremental_save_result result = {};
+
+		// Determine whether we can append to the file: it should be the last one written for this
+		// routine, be untouched since and the data still referenced should not be less than half of it.
 		//
-		rtn->flush_paths();
+		bool append = false;
+		if ( state.path == path && state.file_length && ( state.file_length - state.live_length ) <= state.live_length )
+		{
+			std::error_code ec;
+			if ( std::filesystem::file_size( path, ec ) == state.file_length && !ec )
+			{
+				file_header hdr;
+				file_header_ext ext;
+				index_locator loc;
+				std::ifstream fs( path, std::ios::binary );
+				fs.read( ( char* ) &hdr, sizeof( hdr ) );
+				fs.read( ( char* ) &ext, sizeof( ext ) );
+				fs.read( ( char* ) &loc, sizeof( loc ) );
+				append = fs.good() &&
+					hdr.magic_2 == magic_versioned &&
+					ext.version == format_version_appendable &&
+					loc.offset == state.index_offset;
+			}
+		}
+		if ( !append )
+			state.blocks.clear();
+
+		// Reserve space for the headers if rewriting.
+		//
+		byte_writer out;
+		uint64_t origin = append ? state.file_length : 0;
+		if ( !append )
+			out.write_fields( file_header{}, file_header_ext{}, index_locator{} );
+
+		// Write each block modified since the last save.
+		//
+		std::unordered_map<vip_t, serialization_state::block_entry> blocks;
+		uint64_t live_length = appendable_header_length;
+		for ( auto& [vip, blk] : rtn->explored_blocks )
+		{
+			hash_t key = block_key( blk );
+			auto it = state.blocks.find( vip );
+			if ( it != state.blocks.end() && it->second.key == key )
+			{
+				blocks.emplace( vip, it->second );
+				result.blocks_reused++;
+			}
+			else
+			{
+				uint64_t offset = origin + out.size();
+				write_chunk( out, [ & ] () { serialize( out, blk ); } );
+				blocks.emplace( vip, serialization_state::block_entry{ key, offset, uint32_t( origin + out.size() - offset ) } );
+				result.blocks_written++;
+			}
+			live_length += blocks[ vip ].length;
+		}
+
+		// Write the index.
+		//
+		uint64_t index_offset = origin + out.size();
+		write_chunk( out, [ & ] ()
+		{
+			serialize<clength_t>( out, blocks.size() );
+			for ( auto& [vip, entry] : blocks )
+				out.write_fields( vip, entry.offset );
+			serialize_properties( out, rtn );
+		} );
+		uint64_t file_length = origin + out.size();
+		live_length += file_length - index_offset;
+
+		// Create the headers.
+		//
+		file_header_ext ext = {
+			.version = format_version_appendable,
+			.block_count = ( uint32_t ) blocks.size(),
+			.instruction_count = rtn->num_instructions()
+		};
+		ext.checksum = checksum_header( ext );
+		index_locator loc = { .offset = index_offset };
+		loc.checksum = crc32c( &loc.offset, sizeof( loc.offset ) );
+
+		byte_writer headers;
+		headers.write_fields( file_header{ .arch_id = rtn->arch_id }, ext, loc );
+
+		// If rewriting, write the headers and the data at once.
+		//
+		if ( !append )
+		{
+			memcpy( out.data(), headers.data(), headers.size() );
+			std::ofstream fs( path, std::ios::binary | std::ios::trunc );
+			if ( !fs.good() ) fthrow( "File %s cannot be opened for write.", path );
+			out.flush( fs );
+			if ( !fs.good() ) fthrow( "Failed writing to file %s.", path );
+			result.bytes_written = file_length;
+		}
+		// Otherwise append the data and then patch the headers so that the file stays 
+		// consistent with the previous index until the very last write.
+		//
+		else
+		{
+			std::fstream fs( path, std::ios::binary | std::ios::in | std::ios::out );
+			if ( !fs.good() ) fthrow( "File %s cannot be opened for write.", path );
+			result.bytes_written = out.size() + headers.size();
+			fs.seekp( origin );
+			out.flush( fs );
+			fs.flush();
+			fs.seekp( 0 );
+			headers.flush( fs );
+			if ( !fs.good() ) fthrow( "Failed writing to file %s.", path );
+		}
+		result.appended = append;
+
+		// Update the state.
+		//
+		state.path = path;
+		state.blocks = std::move( blocks );
+		state.file_length = file_length;
+		state.live_length = live_length;
+		state.index_offset = index_offset;
+		return result;
 	}
 
 	// Serialization of VTIL instructions.
 	//
-	void serialize( std::ostream& out, const instruction& in )
+	void serialize( byte_writer& out, const instruction& in )
 	{
 		// Write only the name of the instruction instead of the pointer.
 		//
@@ -251,12 +887,9 @@ namespace vtil
 		// Write rest as is.
 		//
 		serialize( out, in.operands );
-		serialize( out, in.vip );
-		serialize( out, in.sp_offset );
-		serialize( out, in.sp_index );
-		serialize( out, in.sp_reset );
+		out.write_fields( in.vip, in.sp_offset, in.sp_index, in.sp_reset );
 	}
-	void deserialize( std::istream& in, instruction& out )
+	void deserialize( byte_reader& in, instruction& out )
 	{
 		// Find the instruction by its name and write the pointer to the matched instance.
 		//
@@ -279,31 +912,24 @@ namespace vtil
 		// Read rest as is and validate.
 		//
 		deserialize( in, out.operands );
-		deserialize( in, out.vip );
-		deserialize( in, out.sp_offset );
-		deserialize( in, out.sp_index );
-		deserialize( in, out.sp_reset );
+		in.read_fields( out.vip, out.sp_offset, out.sp_index, out.sp_reset );
 		if( !out.is_valid() )
 			throw std::runtime_error( "Resolved invalid instruction." );
 	}
 
 	// Serialization of VTIL operands.
 	//
-	void serialize( std::ostream& out, const operand& in )
+	void serialize( byte_writer& out, const operand& in )
 	{
-		// Write type index.
-		//
-		serialize<clength_t>( out, in.descriptor.index() );
-		
-		// Write the variant.
+		// Write type index and the variant.
 		//
 		if ( in.descriptor.index() == 0 ) 
-			return serialize( out, std::get<operand::immediate_t>( in.descriptor ) );
+			return out.write_fields( clength_t( 0 ), std::get<operand::immediate_t>( in.descriptor ) );
 		if ( in.descriptor.index() == 1 ) 
-			return serialize( out, std::get<operand::register_t>( in.descriptor ) );
+			return out.write_fields( clength_t( 1 ), std::get<operand::register_t>( in.descriptor ) );
 		unreachable();
 	}
-	void deserialize( std::istream& in, operand& out )
+	void deserialize( byte_reader& in, operand& out )
 	{
 		// Read type index.
 		//
@@ -329,5 +955,35 @@ namespace vtil
 			throw std::runtime_error( "Resolved invalid operand." );
 		}
 	}
+
+	// Wrappers around the functions above taking standard streams.
+	//
+	void serialize( std::ostream& ss, const basic_block* in )
+	{
+		byte_writer out;
+		serialize( out, in );
+		out.flush( ss );
+	}
+	void deserialize( std::istream& ss, routine* rtn, basic_block*& blk )
+	{
+		byte_reader in{ ss };
+		deserialize( in, rtn, blk );
+	}
+	void serialize( std::ostream& ss, const routine* rtn )
+	{
+		byte_writer out;
+		serialize( out, rtn );
+		out.flush( ss );
+	}
+	void deserialize( std::istream& ss, routine*& rtn )
+	{
+		byte_reader in{ ss };
+		deserialize( in, rtn );
+	}
+	routine_summary probe( std::istream& ss, bool verify_checksums )
+	{
+		byte_reader in{ ss };
+		return probe( in, verify_checksums );
+	}
 };
 #pragma warning(default:4267)
\ No newline at end of file
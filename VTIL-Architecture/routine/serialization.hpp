@@ -32,6 +32,8 @@
 #include <vector>
 #include <string>
 #include <filesystem>
+#include <cstring>
+#include <vtil/io>
 #include "routine.hpp"
 #include "basic_block.hpp"
 #include "instruction.hpp"
@@ -105,73 +107,278 @@ namespace vtil
 	//
 	using clength_t = int32_t;
 
+	// Current revision of the file format, files written before versioning was 
+	// introduced are reported as version 0.
+	//
+	static constexpr uint16_t format_version = 1;
+
+	// Revision of the appendable file format written by ::save_routine_incremental, blocks 
+	// are located through an index which is rewritten at the end of the file on each save.
+	//
+	static constexpr uint16_t format_version_appendable = 2;
+
+	// Summary of a serialized routine as reported by ::probe.
+	//
+	struct routine_summary
+	{
+		// Reason the file was rejected, empty if valid.
+		//
+		std::string error;
+
+		// Properties read from the headers.
+		//
+		uint16_t version = 0;
+		architecture_identifier arch_id = architecture_amd64;
+		size_t block_count = 0;
+		size_t instruction_count = 0;
+		size_t byte_count = 0;
+
+		// Validity check.
+		//
+		bool is_valid() const { return error.empty(); }
+		explicit operator bool() const { return is_valid(); }
+	};
+
+	// State of the incremental serializer, stored in the routine context. Records the 
+	// location of each block in the last file written and a key identifying its state.
+	//
+	struct serialization_state
+	{
+		struct block_entry
+		{
+			hash_t key;
+			uint64_t offset;
+			uint32_t length;
+		};
+
+		// Path of the file and the blocks it contains.
+		//
+		std::filesystem::path path;
+		std::unordered_map<vip_t, block_entry> blocks;
+
+		// Total length of the file, length of the data still referenced and the offset of the index.
+		//
+		uint64_t file_length = 0;
+		uint64_t live_length = 0;
+		uint64_t index_offset = 0;
+	};
+
+	// Statistics reported by ::save_routine_incremental.
+	//
+	struct incremental_save_result
+	{
+		size_t blocks_written = 0;
+		size_t blocks_reused = 0;
+		size_t bytes_written = 0;
+		bool appended = false;
+	};
+
+	// Growable contiguous buffer that the serialization routines write into.
+	//
+	struct byte_writer
+	{
+		// Backing storage, only the first [length] bytes are valid.
+		//
+		std::vector<uint8_t> storage;
+		size_t length = 0;
+
+		// Makes sure the next [n] bytes are writable and returns a pointer to them, 
+		// caller should ::commit the number of bytes written afterwards.
+		//
+		uint8_t* reserve( size_t n )
+		{
+			if ( ( storage.size() - length ) < n )
+				storage.resize( std::max( storage.size() * 2, length + std::max<size_t>( n, 256 ) ) );
+			return storage.data() + length;
+		}
+		void commit( size_t n ) { length += n; }
+
+		// Writes raw data.
+		//
+		void write( const void* data, size_t n )
+		{
+			memcpy( reserve( n ), data, n );
+			length += n;
+		}
+
+		// Writes a record of trivial fields with a single bounds check.
+		//
+		template<typename... Tx>
+		void write_fields( const Tx&... fields )
+		{
+			uint8_t* out = reserve( ( sizeof( Tx ) + ... ) );
+			( ( memcpy( out, &fields, sizeof( Tx ) ), out += sizeof( Tx ) ), ... );
+			length += ( sizeof( Tx ) + ... );
+		}
+
+		// Buffer accessors.
+		//
+		const uint8_t* data() const { return storage.data(); }
+		uint8_t* data()             { return storage.data(); }
+		size_t size() const         { return length; }
+		void clear()                { length = 0; }
+
+		// Writes the buffer into the given stream and clears it.
+		//
+		void flush( std::ostream& out )
+		{
+			out.write( ( const char* ) data(), size() );
+			clear();
+		}
+	};
+
+	// Reader over a contiguous memory region (such as a memory mapped file) or over 
+	// a stream, in which case the bytes are fetched on demand record by record.
+	//
+	struct byte_reader
+	{
+		// Current position and the limit of the readable region.
+		//
+		const uint8_t* cursor = nullptr;
+		const uint8_t* limit = nullptr;
+
+		// Source stream and the window holding the bytes fetched from it if stream backed.
+		//
+		std::istream* source = nullptr;
+		std::vector<uint8_t> window;
+
+		// Construct from a memory region or a stream.
+		//
+		byte_reader( const void* data, size_t length )
+			: cursor( ( const uint8_t* ) data ), limit( ( const uint8_t* ) data + length ) {}
+		explicit byte_reader( std::istream& in )
+			: source( &in ) {}
+
+		// No copy, default move.
+		//
+		byte_reader( byte_reader&& ) = default;
+		byte_reader( const byte_reader& ) = delete;
+		byte_reader& operator=( byte_reader&& ) = default;
+		byte_reader& operator=( const byte_reader& ) = delete;
+
+		// Makes sure the next [n] bytes are readable, throws if not.
+		//
+		void require( size_t n )
+		{
+			if ( size_t( limit - cursor ) < n )
+				refill( n );
+		}
+
+		// Returns a pointer to the next [n] bytes and skips over them, pointer stays valid 
+		// only until the next read unless the reader is stable (not stream backed).
+		//
+		const uint8_t* view( size_t n )
+		{
+			require( n );
+			const uint8_t* result = cursor;
+			cursor += n;
+			return result;
+		}
+		bool is_stable() const { return !source; }
+
+		// Reads raw data.
+		//
+		void read( void* out, size_t n ) { memcpy( out, view( n ), n ); }
+
+		// Reads a record of trivial fields with a single bounds check.
+		//
+		template<typename... Tx>
+		void read_fields( Tx&... fields )
+		{
+			const uint8_t* in = view( ( sizeof( Tx ) + ... ) );
+			( ( memcpy( &fields, in, sizeof( Tx ) ), in += sizeof( Tx ) ), ... );
+		}
+
+		// Skips the next [n] bytes.
+		//
+		void skip( size_t n );
+
+		// Number of bytes left in the buffered region.
+		//
+		size_t remaining() const { return limit - cursor; }
+
+		// Number of bytes left in the input including the unread part of the source stream, 
+		// SIZE_MAX if the stream cannot report its length.
+		//
+		size_t available() const;
+
+	protected:
+		// Fetches more data from the source so that at least [n] bytes are readable.
+		//
+		void refill( size_t n );
+	};
+
 	// Serialization of any type except standard containers and pointers.
 	//
 	template<typename T, std::enable_if_t<!std::is_pointer_v<T> && !impl::is_std_container_v<T>, int> = 0>
-	static void serialize( std::ostream& ss, const T& v ) 
+	static void serialize( byte_writer& out, const T& v ) 
 	{ 
 		// Write the actual value.
 		//
-		ss.write( ( const char* ) &v, sizeof( T ) ); 
+		out.write_fields( v );
 	}
 	template<typename T, std::enable_if_t<!std::is_pointer_v<T> && !impl::is_std_container_v<T>, int> = 0>
-	static void deserialize( std::istream& ss, T& v ) 
+	static void deserialize( byte_reader& in, T& v ) 
 	{
 		// Read the actual value.
 		//
-		ss.read( ( char* ) &v, sizeof( T ) );
-		if ( ss.eof() || ss.fail() ) throw std::out_of_range( "Reading past file end." );
+		in.read_fields( v );
 	}
 
 	// Serialization of standard containers.
 	//
 	template<typename T, std::enable_if_t<impl::is_std_container_v<T>, int> = 0>
-	static void serialize( std::ostream& ss, const T& v )
+	static void serialize( byte_writer& out, const T& v )
 	{
 		using value_type = typename T::value_type;
 
-		// Serialize the number of entries.
+		// Determine the number of entries.
 		//
 		clength_t n = v.size();
-		serialize<clength_t>( ss, n );
 
 		// If container stores data linearly and trivial data is stored:
 		//
 		if constexpr ( impl::is_linear_container_v<T> && std::is_trivial<value_type>::value )
 		{
-			// Resize the container to expected size and read all entries at once.
+			// Write the number of entries and all entries at once.
 			//
-			ss.write( ( char* ) v.data(), n * sizeof( value_type ) );
+			size_t length = n * sizeof( value_type );
+			uint8_t* data = out.reserve( sizeof( clength_t ) + length );
+			memcpy( data, &n, sizeof( clength_t ) );
+			memcpy( data + sizeof( clength_t ), v.data(), length );
+			out.commit( sizeof( clength_t ) + length );
 		}
 		// Otherwise, default back to per-element invokation.
 		//
 		else
 		{
-			// Serialize each entry.
+			// Serialize the number of entries and then each entry.
 			//
+			serialize<clength_t>( out, n );
 			for ( auto& entry : v )
-				serialize( ss, entry );
+				serialize( out, entry );
 		}
 	}
 	template<typename T, std::enable_if_t<impl::is_std_container_v<T>, int> = 0>
-	static void deserialize( std::istream& ss, T& v )
+	static void deserialize( byte_reader& in, T& v )
 	{
 		using value_type = typename T::value_type;
 
 		// Deserialize the entry counter from the stream and reset the container.
 		//
 		clength_t n;
-		deserialize( ss, n );
+		deserialize( in, n );
+		if ( n < 0 ) throw std::runtime_error( "Invalid container length." );
 
 		// If container stores data linearly and trivial data is stored:
 		//
 		if constexpr ( impl::is_linear_container_v<T> && std::is_trivial<value_type>::value )
 		{
-			// Resize the container to expected size and read all entries at once.
+			// Check the bounds, resize the container to expected size and read all entries at once.
 			//
+			const uint8_t* data = in.view( n * sizeof( value_type ) );
 			v.resize( n );
-			ss.read( ( char* ) v.data(), n * sizeof( value_type ) );
-			if ( ss.eof() || ss.fail() ) throw std::out_of_range( "Reading past file end." );
+			memcpy( v.data(), data, n * sizeof( value_type ) );
 		}
 		// Otherwise, default back to per-element invokation.
 		//
@@ -186,7 +393,7 @@ namespace vtil
 			while ( n-- > 0 )
 			{
 				value_type value;
-				deserialize( ss, value );
+				deserialize( in, value );
 				impl::move_back( v, std::move( value ) );
 			}
 		}
@@ -194,42 +401,88 @@ namespace vtil
 
 	// Serialization of VTIL calling conventions.
 	//
-	void serialize( std::ostream& out, const call_convention& in );
-	void deserialize( std::istream& in, call_convention& out );
+	void serialize( byte_writer& out, const call_convention& in );
+	void deserialize( byte_reader& in, call_convention& out );
 
 	// Serialization of VTIL blocks.
 	//
-	void serialize( std::ostream& out, const basic_block* in );
-	void deserialize( std::istream& in, routine* rtn, basic_block*& blk );
+	void serialize( byte_writer& out, const basic_block* in );
+	void deserialize( byte_reader& in, routine* rtn, basic_block*& blk );
 
 	// Serialization of VTIL routines.
 	//
-	void serialize( std::ostream& out, const routine* rtn );
-	void deserialize( std::istream& in, routine*& rtn );
+	void serialize( byte_writer& out, const routine* rtn );
+	void deserialize( byte_reader& in, routine*& rtn );
+
+	// Validates the headers and the chunk checksums of a serialized routine and reports
+	// the block and instruction counts without decoding it.
+	//
+	routine_summary probe( byte_reader& in, bool verify_checksums = true );
 
 	// Serialization of VTIL instructions.
 	//
-	void serialize( std::ostream& out, const instruction& in );
-	void deserialize( std::istream& in, instruction& out );
+	void serialize( byte_writer& out, const instruction& in );
+	void deserialize( byte_reader& in, instruction& out );
 
 	// Serialization of VTIL operands.
 	//
-	void serialize( std::ostream& out, const operand& in );
-	void deserialize( std::istream& in, operand& out );
+	void serialize( byte_writer& out, const operand& in );
+	void deserialize( byte_reader& in, operand& out );
+
+	// Wrappers around the functions above taking standard streams.
+	//
+	template<typename T, std::enable_if_t<!std::is_pointer_v<T>, int> = 0>
+	static void serialize( std::ostream& ss, const T& v )
+	{
+		byte_writer out;
+		serialize( out, v );
+		out.flush( ss );
+	}
+	template<typename T, std::enable_if_t<!std::is_pointer_v<T>, int> = 0>
+	static void deserialize( std::istream& ss, T& v )
+	{
+		byte_reader in{ ss };
+		deserialize( in, v );
+	}
+	void serialize( std::ostream& out, const basic_block* in );
+	void deserialize( std::istream& in, routine* rtn, basic_block*& blk );
+	void serialize( std::ostream& out, const routine* rtn );
+	void deserialize( std::istream& in, routine*& rtn );
+	routine_summary probe( std::istream& in, bool verify_checksums = true );
 
 	// Simple wrappers for serialize / deserialize routine.
 	//
 	static void save_routine( const routine* rtn, const std::filesystem::path& path )
 	{
-		std::ofstream fs( path, std::ios::binary );
-		serialize( fs, rtn );
+		byte_writer out;
+		serialize( out, rtn );
+		file::write_raw( path, out.data(), out.size() );
 	}
 	static routine* load_routine( const std::filesystem::path& path )
 	{
 		routine* rtn;
-		std::ifstream fs( path, std::ios::binary );
-		deserialize( fs, rtn );
+		file::mapped_view view{ path };
+		byte_reader in{ view.data(), view.size() };
+		deserialize( in, rtn );
+
+		// If the file was written incrementally, bind the state to the path so that the next 
+		// incremental save can append to it.
+		//
+		if ( rtn->context.has<serialization_state>() )
+			rtn->context.get<serialization_state>().path = path;
 		return rtn;
 	}
+
+	// Saves the routine in the appendable format, if the file at the given path was the last one 
+	// written (or loaded) for this routine, only the blocks modified since are appended to it 
+	// along with a new index; otherwise or if the file is mostly unreferenced data, it is rewritten.
+	//
+	incremental_save_result save_routine_incremental( const routine* rtn, const std::filesystem::path& path );
+	static routine_summary probe_routine( const std::filesystem::path& path, bool verify_checksums = true )
+	{
+		file::mapped_view view{ path };
+		byte_reader in{ view.data(), view.size() };
+		return probe( in, verify_checksums );
+	}
 };
 #pragma warning(default:4267)
\ No newline at end of file
@@ -176,6 +176,67 @@ namespace vtil::symbolic
 		}
 	}
 
+	// Pointer resolved for a memory operand, stored in the instruction context. Entries are tagged
+	// with the block and the epoch they were resolved at, if the tracer was in recursive mode the
+	// result may depend on other blocks so the epoch of the routine is used instead.
+	//
+	struct memory_operand_cache
+	{
+		struct entry
+		{
+			const basic_block* block = nullptr;
+			epoch_t epoch = invalid_epoch;
+			std::optional<pointer> ptr;
+		};
+
+		relaxed<std::mutex> mtx;
+		entry in_block;
+		entry cross_block;
+	};
+
+	// Resolves the pointer accessed by the memory operand of the instruction, the instruction 
+	// is asked about many variables in a row during tracing so the result is cached on it if
+	// the tracer implements the default tracing logic.
+	//
+	static pointer resolve_pointer( const il_const_iterator& it, tracer* tracer )
+	{
+		const auto resolve = [ & ] ()
+		{
+			auto [base, offset] = it->memory_location();
+			return pointer{ tracer->trace( { it, base } ) + offset };
+		};
+
+		// Derived tracers may change the result, skip the cache if so.
+		//
+		if ( !tracer->is_pure() )
+			return resolve();
+
+		// Pick the entry and the current epoch.
+		//
+		auto& cache = it->context.get<memory_operand_cache>();
+		bool xblock = vtil::tracer::recursive_flag;
+		auto& entry = xblock ? cache.cross_block : cache.in_block;
+		epoch_t epoch = xblock ? it.block->owner->epoch.load() : it.block->epoch;
+
+		// Return the cached pointer if still valid.
+		//
+		{
+			std::lock_guard _g( cache.mtx );
+			if ( entry.block == it.block && entry.epoch == epoch )
+				return *entry.ptr;
+		}
+
+		// Resolve and save the pointer unless the rtrace budget was exhausted while doing so, 
+		// in which case the result depends on the budget.
+		//
+		pointer ptr = resolve();
+		if ( vtil::tracer::is_budget_exhausted() )
+			return ptr;
+		std::lock_guard _g( cache.mtx );
+		entry = { .block = it.block, .epoch = epoch, .ptr = ptr };
+		return ptr;
+	}
+
 	// Implement generic access check for ::read_by & ::written_by.
 	//
 	static access_details test_access( const variable& var, const il_const_iterator& it, tracer* tracer, bool cwrite, bool cread, bool xblock )
@@ -188,7 +249,7 @@ namespace vtil::symbolic
 		{
 			// Iterate each operand:
 			//
-			for ( int i = 0; i < it->base->operand_count(); i++ )
+			for ( size_t i = 0; i < it->base->operand_count(); i++ )
 			{
 				// Skip if not register.
 				//
@@ -235,8 +296,7 @@ namespace vtil::symbolic
 			{
 				// Generate an expression for the pointer.
 				//
-				auto [base, offset] = it->memory_location();
-				pointer ptr = { tracer->trace( { it, base } ) + offset };
+				pointer ptr = resolve_pointer( it, tracer );
 
 				// Calculate displacement.
 				//
@@ -0,0 +1,119 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vector>
+#include <optional>
+#include <unordered_map>
+#include "variable.hpp"
+
+namespace vtil::symbolic
+{
+	// Compact identifier of an interned variable, two identifiers issued by the same table are 
+	// equal if and only if the variables are equal.
+	//
+	using variable_id = uint64_t;
+	static constexpr variable_id invalid_variable_id = ~0ull;
+
+	// Table interning variables into compact identifiers so that the variable is hashed and 
+	// compared once and every side structure can be indexed by the identifier instead. The low
+	// half of the identifier is a dense index and the high half is the generation of the table,
+	// so that identifiers issued before a reset never alias the ones issued after.
+	//
+	struct variable_interner
+	{
+		std::unordered_map<variable, uint32_t> ids;
+		std::vector<const variable*> variables;
+		uint32_t generation = 0;
+
+		// Default construct.
+		//
+		variable_interner() = default;
+
+		// Copying rebuilds the index since it points into the map.
+		//
+		variable_interner( variable_interner&& ) = default;
+		variable_interner( const variable_interner& o ) : ids( o.ids ), generation( o.generation ) { reindex(); }
+		variable_interner& operator=( variable_interner&& ) = default;
+		variable_interner& operator=( const variable_interner& o ) { ids = o.ids; generation = o.generation; reindex(); return *this; }
+
+		// Converts between the identifier and the dense index.
+		//
+		variable_id make_id( uint32_t index ) const { return ( variable_id( generation ) << 32 ) | index; }
+		static uint32_t index_of( variable_id id ) { return uint32_t( id ); }
+
+		// Returns the identifier of the variable, interning it if not already.
+		//
+		variable_id intern( const variable& var )
+		{
+			auto [it, inserted] = ids.emplace( var, ( uint32_t ) variables.size() );
+			if ( inserted )
+				variables.emplace_back( &it->first );
+			return make_id( it->second );
+		}
+
+		// Returns the identifier of the variable if interned.
+		//
+		std::optional<variable_id> find( const variable& var ) const
+		{
+			if ( auto it = ids.find( var ); it != ids.end() )
+				return make_id( it->second );
+			return std::nullopt;
+		}
+
+		// Checks if the identifier was issued by the current generation of the table.
+		//
+		bool contains( variable_id id ) const { return ( id >> 32 ) == generation && index_of( id ) < variables.size(); }
+
+		// Returns the variable of an identifier issued by the current generation.
+		//
+		const variable& resolve( variable_id id ) const { return *variables[ index_of( id ) ]; }
+
+		// Returns the number of variables interned.
+		//
+		size_t size() const { return variables.size(); }
+
+		// Drops every variable, invalidating all identifiers issued.
+		//
+		void reset()
+		{
+			ids.clear();
+			variables.clear();
+			generation++;
+		}
+
+	private:
+		// Rebuilds the dense index from the map.
+		//
+		void reindex()
+		{
+			variables.assign( ids.size(), nullptr );
+			for ( auto& [var, index] : ids )
+				variables[ index ] = &var;
+		}
+	};
+};
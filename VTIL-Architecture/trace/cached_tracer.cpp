@@ -41,6 +41,12 @@ namespace vtil
 		//
 		log<CON_BRG>( "CcTrace(%s)\n", lookup );
 		scope_padding _p( 1 );
+	#endif
+	#if VTIL_OPT_TRACE_STATISTICS
+		// Time the call.
+		//
+		auto& stats = trace_statistics::global();
+		trace_statistics::scoped_timer _t( stats.trace_time_ns, trace_statistics::trace_nesting );
 	#endif
 		// Handle base case.
 		//
@@ -55,56 +61,45 @@ namespace vtil
 			return result;
 		}
 
+		// Prune the caches of deleted blocks if the control flow changed.
+		//
+		const basic_block* blk = lookup.at.block;
+		if ( blk->owner->cfg_epoch != pruned_cfg_epoch )
+			prune( blk->owner );
+
 		// Try lookup the exact variable in the map in a fast manner.
 		//
-		std::shared_lock lock{ mtx };
-		auto it = cache.find( lookup );
-		if ( it != cache.end() )
+		shard& s = shard_of( blk );
+		std::shared_lock lock{ s.mtx };
+		block_cache* cache = nullptr;
+		if ( auto bit = s.blocks.find( blk ); bit != s.blocks.end() )
 		{
-			// If recursive flag is set, fix the expression:
-			//
-			/*if ( recursive_flag )
+			cache = &bit->second;
+			if ( auto slot = cache->find( lookup ); slot && slot->entry && slot->entry->is_valid( blk ) )
 			{
-				symbolic::expression result = *it->second;
-				lock = {};
-
-				if ( result )
-				{
-					result.transform( [ & ] ( symbolic::expression& exp )
-					{
-						if ( exp.is_variable() )
-						{
-							auto& var = exp.uid.get<symbolic::variable>();
-							if ( !var.at.is_begin() )
-								exp = tracer::trace( var );
-						}
-					} );
-				}
-				else
-				{
-					result = tracer::trace( lookup );
-				}
-
-				return result;
-			}*/
-
-			symbolic::expression::reference& result = it->second;
+				symbolic::expression::reference& result = slot->entry->result;
+#if VTIL_OPT_TRACE_STATISTICS
+				stats.count( trace_statistics::cache_hits );
+#endif
 #if VTIL_OPT_TRACE_VERBOSE
-			// Log result.
-			//
-			log<CON_BLU>( "= %s [Cached result]\n", result );
+				// Log result.
+				//
+				log<CON_BLU>( "= %s [Cached result]\n", result );
 #endif
-			return result;
+				return result;
+			}
 		}
 
 		// Declare a predicate for the search of the variable in the cache.
 		//
-		auto predicate = [ & ] ( const cache_entry& pair )
+		auto predicate = [ & ] ( const symbolic::variable& key, const block_cache::slot& slot )
 		{
-			// Key must be of same type at the same position.
+			// Key must be of same type at the same position and must not be stale.
 			//
-			if ( pair.first.is_register() != lookup.is_register() || 
-				 pair.first.at != lookup.at ) 
+			if ( !slot.entry ||
+				 key.is_register() != lookup.is_register() || 
+				 key.at != lookup.at ||
+				 !slot.entry->is_valid( blk ) ) 
 				return false;
 
 			if ( lookup.is_memory() )
@@ -112,7 +107,7 @@ namespace vtil
 				// Must be the same pointer and have a larger or equal size.
 				//
 				auto& self = lookup.mem();
-				auto& other = pair.first.mem();
+				auto& other = key.mem();
 				return self.bit_count >= other.bit_count && 
 					self.decay()->equals( *other.decay() );
 			}
@@ -121,7 +116,7 @@ namespace vtil
 				// Must be the same register and have a larger or equal size.
 				//
 				auto& self = lookup.reg();
-				auto& other = pair.first.reg();
+				auto& other = key.reg();
 				return self.flags == other.flags &&
 					self.combined_id == other.combined_id &&
 					self.bit_offset == other.bit_offset &&
@@ -129,28 +124,129 @@ namespace vtil
 			}
 		};
 
-
-		// Search the map, if we find a matching entry shrink and use as the result.
+		// Search the block cache, if we find a matching entry shrink and use as the result.
 		//
 		symbolic::expression::reference result;
-		it = std::find_if( cache.begin(), cache.end(), predicate );
-		if ( it != cache.end() )
+		std::optional<cached_result> partial;
+		if ( cache )
+		{
+			for ( size_t n = 0; n != cache->slots.size(); n++ )
+			{
+				if ( predicate( cache->key_of( n ), cache->slots[ n ] ) )
+				{
+					partial = cache->slots[ n ].entry;
+					break;
+				}
+			}
+		}
+		if ( partial )
 		{
-			result = it->second;
 			lock = {};
+#if VTIL_OPT_TRACE_STATISTICS
+			stats.count( trace_statistics::cache_partial_hits );
+#endif
+			result = partial->result;
 			result.resize( lookup.bit_count() );
+			partial->result = result;
+
+			std::unique_lock ulock{ s.mtx };
+			s.blocks[ blk ].get( lookup ).entry = std::move( partial );
 		}
 		else
 		{
 			lock = {};
-			result = tracer::trace( lookup );
-		}
 
-		// Insert a cache entry for the exact variable we're looking up and return.
-		//
-		{
-			std::unique_lock ulock{ mtx };
-			cache.emplace( lookup, result );
+			// Acquire an exclusive lock and check if another thread is already 
+			// tracing this variable or has finished tracing it in the meantime.
+			//
+			std::unique_lock ulock{ s.mtx };
+			cache = &s.blocks[ blk ];
+
+			// Drop the variables invalidated since the last miss in this block so that the
+			// cache of a block that keeps getting modified does not grow without bound.
+			//
+			cache->owner = blk->owner;
+			if ( epoch_t epoch = blk->owner->epoch; std::exchange( cache->epoch, epoch ) != epoch )
+				cache->compact( blk );
+			block_cache::slot* slot = &cache->get( lookup );
+			if ( slot->entry )
+			{
+				if ( slot->entry->is_valid( blk ) )
+				{
+#if VTIL_OPT_TRACE_STATISTICS
+					stats.count( trace_statistics::cache_hits );
+#endif
+					return slot->entry->result;
+				}
+				slot->entry.reset();
+			}
+			if ( slot->pending.valid() && !active_traces )
+			{
+				auto future = slot->pending;
+				ulock = {};
+#if VTIL_OPT_TRACE_STATISTICS
+				stats.count( trace_statistics::cache_waits );
+#endif
+				return future.get();
+			}
+#if VTIL_OPT_TRACE_STATISTICS
+			stats.count( trace_statistics::cache_misses );
+#endif
+
+			// Register the trace as in-flight, unless another thread owns the entry 
+			// in which case we trace without publishing it.
+			//
+			std::promise<symbolic::expression::reference> promise;
+			uint64_t generation = s.generation;
+			bool owner = !slot->pending.valid();
+			if ( owner )
+				slot->pending = promise.get_future().share();
+			ulock = {};
+
+			// Save the epoch before tracing so that any modification while tracing 
+			// invalidates the result.
+			//
+			cached_result entry = {};
+			entry.epoch = recursive_flag ? blk->owner->epoch.load() : blk->epoch;
+			entry.xblock = recursive_flag;
+
+			// Invoke the original tracer.
+			//
+			active_traces++;
+			try
+			{
+				result = tracer::trace( lookup );
+			}
+			catch ( ... )
+			{
+				active_traces--;
+				if ( owner )
+				{
+					ulock = std::unique_lock{ s.mtx };
+					if ( s.generation == generation )
+						s.blocks[ blk ].get( lookup ).pending = {};
+					ulock = {};
+					promise.set_exception( std::current_exception() );
+				}
+				throw;
+			}
+			active_traces--;
+			entry.result = result;
+
+			// Insert a cache entry for the exact variable we're looking up unless the 
+			// cache was flushed or the tracing budget was exhausted while tracing, and 
+			// wake up the waiting threads.
+			//
+			ulock = std::unique_lock{ s.mtx };
+			if ( s.generation == generation )
+			{
+				block_cache::slot& slot = s.blocks[ blk ].get( lookup );
+				if ( !is_budget_exhausted() )
+					slot.entry = std::move( entry );
+				if ( owner ) slot.pending = {};
+			}
+			ulock = {};
+			if ( owner ) promise.set_value( result );
 		}
 
 	#if VTIL_OPT_TRACE_VERBOSE
@@ -160,4 +256,38 @@ namespace vtil
 	#endif
 		return result;
 	}
+
+	// Memoizes the path summaries, since the summaries are composed of traces across 
+	// multiple blocks they are always tagged with the epoch of the routine.
+	//
+	std::optional<symbolic::expression::reference> cached_tracer::find_summary( const symbolic::variable& lookup )
+	{
+		const basic_block* blk = lookup.at.block;
+		shard& s = summaries[ shard_index( blk ) ];
+
+		std::shared_lock lock{ s.mtx };
+		if ( auto bit = s.blocks.find( blk ); bit != s.blocks.end() )
+			if ( auto slot = bit->second.find( lookup ); slot && slot->entry && slot->entry->is_valid( blk ) )
+				return slot->entry->result;
+		return std::nullopt;
+	}
+	void cached_tracer::save_summary( const symbolic::variable& lookup, const symbolic::expression::reference& result )
+	{
+		const basic_block* blk = lookup.at.block;
+		shard& s = summaries[ shard_index( blk ) ];
+
+		// Every summary of the block is stale once the routine is modified, so drop them
+		// before saving a summary at a new epoch.
+		//
+		epoch_t epoch = blk->owner->epoch;
+		std::unique_lock lock{ s.mtx };
+		block_cache& cache = s.blocks[ blk ];
+		cache.owner = blk->owner;
+		if ( std::exchange( cache.epoch, epoch ) != epoch )
+		{
+			cache.variables.reset();
+			cache.slots.clear();
+		}
+		cache.get( lookup ).entry = cached_result{ result, epoch, true };
+	}
 };
\ No newline at end of file
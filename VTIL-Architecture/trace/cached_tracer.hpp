@@ -29,9 +29,15 @@
 #include <vtil/symex>
 #include <vtil/common>
 #include <unordered_map>
+#include <unordered_set>
 #include <shared_mutex>
+#include <future>
+#include <array>
+#include <optional>
+#include <vector>
 #include "tracer.hpp"
 #include "../symex/variable.hpp"
+#include "../symex/variable_interner.hpp"
 
 namespace vtil
 {
@@ -41,24 +47,140 @@ namespace vtil
     //
 	struct cached_tracer : tracer
 	{
-        // Define the type of the cache.
+        // Number of shards the cache is split into, the shard is picked by the 
+        // block of the variable so that all variables in the same block share
+        // a shard and can be matched against or invalidated together.
         //
-        using cache_type =  std::unordered_map<symbolic::variable, symbolic::expression::reference>;
-        using cache_entry = cache_type::value_type;
+        static constexpr size_t shard_count = 32;
 
-        // Declare the lookup map for the cache mapping each variable to the
-        // result of the primitive traver.
+        // Each result is tagged with the epoch it was traced at, which is the epoch
+        // of the block for block-local traces and the epoch of the routine for traces
+        // that crossed block boundaries, stale entries are discarded on lookup.
         //
-        mutable cache_type cache;
-        
-        // Locks the cache.
+        struct cached_result
+        {
+            symbolic::expression::reference result;
+            epoch_t epoch = invalid_epoch;
+            bool xblock = false;
+
+            // Returns whether the result is still valid for a variable in the given block.
+            //
+            bool is_valid( const basic_block* blk ) const 
+            { 
+                return epoch == ( xblock ? blk->owner->epoch.load() : blk->epoch );
+            }
+        };
+
+        // Cache of a single block, the variables traced in the block are interned so that 
+        // each lookup hashes and compares the variable once and everything else is indexed
+        // by its identifier.
+        //
+        struct block_cache
+        {
+            // State of a single variable.
+            //
+            struct slot
+            {
+                // Result of the primitive tracer, if any.
+                //
+                std::optional<cached_result> entry;
+
+                // Future result if the variable is being traced, so that other threads can 
+                // wait on it instead of duplicating the work.
+                //
+                std::shared_future<symbolic::expression::reference> pending;
+            };
+
+            symbolic::variable_interner variables;
+            std::vector<slot> slots;
+
+            // Returns the slot of the variable if it was looked up before.
+            //
+            slot* find( const symbolic::variable& var )
+            {
+                if ( auto id = variables.find( var ) )
+                    return &slots[ symbolic::variable_interner::index_of( *id ) ];
+                return nullptr;
+            }
+
+            // Returns the slot of the variable, creating it if necessary.
+            //
+            slot& get( const symbolic::variable& var )
+            {
+                uint32_t index = symbolic::variable_interner::index_of( variables.intern( var ) );
+                if ( index >= slots.size() )
+                    slots.resize( index + 1 );
+                return slots[ index ];
+            }
+
+            // Returns the variable of the slot at the given index.
+            //
+            const symbolic::variable& key_of( size_t index ) const { return variables.resolve( variables.make_id( ( uint32_t ) index ) ); }
+
+            // Routine the block belongs to and its epoch at the last time stale entries
+            // were dropped, kept so that deleted blocks can be pruned without touching them.
+            //
+            const routine* owner = nullptr;
+            epoch_t epoch = invalid_epoch;
+
+            // Drops the variables whose entries were invalidated and are not being traced,
+            // re-interning the rest so that the tables do not grow without bound.
+            //
+            void compact( const basic_block* blk )
+            {
+                block_cache out = {};
+                out.owner = owner;
+                out.epoch = epoch;
+                for ( size_t n = 0; n != slots.size(); n++ )
+                {
+                    slot& entry = slots[ n ];
+                    if ( entry.entry && !entry.entry->is_valid( blk ) )
+                        entry.entry.reset();
+                    if ( entry.entry || entry.pending.valid() )
+                        out.get( key_of( n ) ) = std::move( entry );
+                }
+                *this = std::move( out );
+            }
+        };
+
+        // Each shard of the cache has its own lock and indexes the caches by the block.
         //
-        mutable relaxed<std::shared_mutex> mtx;
+        struct shard
+        {
+            std::unordered_map<const basic_block*, block_cache> blocks;
+
+            // Incremented on each flush, used to discard results of traces that 
+            // began before the flush.
+            //
+            uint64_t generation = 0;
+
+            // Locks the shard.
+            //
+            relaxed<std::shared_mutex> mtx;
+        };
+        mutable std::array<shard, shard_count> shards;
+
+        // Path summaries saved by rtrace, indexed the same way.
+        //
+        mutable std::array<shard, shard_count> summaries;
+
+        // Control-flow epoch of the routine at the last time deleted blocks were pruned.
+        //
+        relaxed_atomic<epoch_t> pruned_cfg_epoch = invalid_epoch;
 
         // Hooks default tracer and does a cache lookup before invokation.
         //
         symbolic::expression::reference trace( const symbolic::variable& lookup ) override;
 
+        // Caching does not alter the results, unless further derived.
+        //
+        bool is_pure() const override { return typeid( *this ) == typeid( cached_tracer ); }
+
+        // Memoizes the path summaries.
+        //
+        std::optional<symbolic::expression::reference> find_summary( const symbolic::variable& lookup ) override;
+        void save_summary( const symbolic::variable& lookup, const symbolic::expression::reference& result ) override;
+
         // Default construtor.
         //
         cached_tracer() {}
@@ -69,20 +191,124 @@ namespace vtil
         cached_tracer( const cached_tracer& o ) = default;
         cached_tracer& operator=( cached_tracer&& o ) = default;
         cached_tracer& operator=( const cached_tracer& o ) = default;
+
+        // Returns the index of the shard the block belongs to.
+        //
+        static size_t shard_index( const basic_block* blk ) { return ( ( uint64_t ) blk >> 4 ) % shard_count; }
+        shard& shard_of( const basic_block* blk ) const { return shards[ shard_index( blk ) ]; }
+
+        // Inserts the given result into the cache, replacing any previous entry.
+        //
+        void insert( const symbolic::variable& var, const symbolic::expression::reference& result )
+        {
+            if ( !var.at.block ) return;
+            shard& s = shard_of( var.at.block );
+            std::unique_lock lock{ s.mtx };
+            s.blocks[ var.at.block ].get( var ).entry = cached_result{ result, var.at.block->epoch };
+        }
+
+        // Copies every entry in the cache of the other tracer into this one, both shards are
+        // locked together to avoid lock order inversion with a concurrent merge in the reverse 
+        // direction.
+        //
+        void merge( const cached_tracer& o )
+        {
+            if ( &o == this )
+                return;
+            for ( auto [dst, src] : zip( shards, o.shards ) )
+            {
+                std::scoped_lock lock{ src.mtx, dst.mtx };
+                for ( auto& [blk, cache] : src.blocks )
+                {
+                    auto& out = dst.blocks[ blk ];
+                    out.owner = cache.owner;
+                    for ( size_t n = 0; n != cache.slots.size(); n++ )
+                        if ( auto& entry = cache.slots[ n ].entry )
+                            out.get( cache.key_of( n ) ).entry = entry;
+                }
+            }
+        }
+
+        // Enumerates every entry in the cache, each shard is locked for the duration 
+        // of its enumeration so the callback should not trace using this tracer. Entries
+        // of blocks that were modified since are not filtered out.
+        //
+        template<typename T>
+        void enumerate( T&& fn ) const
+        {
+            for ( auto& s : shards )
+            {
+                std::shared_lock lock{ s.mtx };
+                for ( auto& [blk, cache] : s.blocks )
+                    for ( size_t n = 0; n != cache.slots.size(); n++ )
+                        if ( auto& entry = cache.slots[ n ].entry )
+                            if ( enumerator::invoke( fn, cache.key_of( n ), entry->result ).should_break )
+                                return;
+            }
+        }
+
+        // Returns the number of cached entries.
+        //
+        size_t size() const
+        {
+            size_t n = 0;
+            for ( auto& s : shards )
+            {
+                std::shared_lock lock{ s.mtx };
+                for ( auto& [blk, cache] : s.blocks )
+                    for ( auto& slot : cache.slots )
+                        n += slot.entry.has_value();
+            }
+            return n;
+        }
         
         // Flushes the cache.
         //
-        void flush() { cache.clear(); }
-        void flush( basic_block* blk )
+        void flush()
         {
-            std::unique_lock lock{ mtx };
-            for ( auto it = cache.begin(); it != cache.end(); )
+            for ( auto& s : shards )
+            {
+                std::unique_lock lock{ s.mtx };
+                s.blocks.clear();
+                s.generation++;
+            }
+            for ( auto& s : summaries )
+            {
+                std::unique_lock lock{ s.mtx };
+                s.blocks.clear();
+            }
+        }
+        void flush( const basic_block* blk )
+        {
+            shard& s = shard_of( blk );
+            std::unique_lock lock{ s.mtx };
+            if ( s.blocks.erase( blk ) )
+                s.generation++;
+        }
+
+        // Drops the caches of the blocks that were deleted from the routine, skipped if 
+        // the routine is locked by another thread since a trace may be waited on under it.
+        //
+        void prune( const routine* rtn )
+        {
+            std::unique_lock g{ rtn->mutex, std::try_to_lock };
+            if ( !g ) return;
+            epoch_t cfg_epoch = rtn->cfg_epoch;
+            std::unordered_set<const basic_block*> live;
+            for ( auto& [vip, blk] : rtn->explored_blocks )
+                live.insert( blk );
+            g.unlock();
+
+            for ( auto* set : { &shards, &summaries } )
             {
-                if ( it->first.at.block == blk )
-                    it = cache.erase( it );
-                else
-                    it++;
+                for ( auto& s : *set )
+                {
+                    std::unique_lock lock{ s.mtx };
+                    if ( std::erase_if( s.blocks, [ & ] ( auto& e ) { return e.second.owner == rtn && !live.contains( e.first ); } ) )
+                        s.generation++;
+                }
             }
+            pruned_cfg_epoch = cfg_epoch;
         }
 	};
 };
\ No newline at end of file
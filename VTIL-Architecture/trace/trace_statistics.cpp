@@ -0,0 +1,123 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "trace_statistics.hpp"
+#include <algorithm>
+#include <vector>
+
+namespace vtil
+{
+	// Records a primitive trace of the given variable.
+	//
+	void trace_statistics::record_trace( const symbolic::variable& var )
+	{
+		std::lock_guard _g( mtx );
+
+		// Names are only generated on the first occurance.
+		//
+		auto& ventry = variables[ var.hash() ];
+		if ( !ventry.count++ )
+			ventry.name = var.to_string();
+
+		if ( var.at.is_valid() )
+		{
+			auto& bentry = blocks[ var.at.block->entry_vip ];
+			if ( !bentry.count++ )
+				bentry.name = format::hex( var.at.block->entry_vip );
+		}
+	}
+
+	// Resets all statistics.
+	//
+	void trace_statistics::reset()
+	{
+		for ( auto& counter : counters )
+			counter = 0;
+		for ( auto& bucket : depth_histogram )
+			bucket = 0;
+		trace_time_ns = 0;
+		rtrace_time_ns = 0;
+
+		std::lock_guard _g( mtx );
+		variables.clear();
+		blocks.clear();
+	}
+
+	// Dumps the statistics as a JSON object, listing the [top_n] most traced variables and blocks.
+	//
+	std::string trace_statistics::to_json( size_t top_n )
+	{
+		// Escapes a string for JSON.
+		//
+		const auto quote = [ ] ( const std::string& str )
+		{
+			std::string out = "\"";
+			for ( char c : str )
+			{
+				if ( c == '"' || c == '\\' )
+					out += '\\';
+				if ( ( uint8_t ) c < 0x20 )
+					out += format::str( "\\u%04x", c );
+				else
+					out += c;
+			}
+			return out + "\"";
+		};
+
+		// Lists the top entries of a map.
+		//
+		const auto list_top = [ & ] ( const auto& map )
+		{
+			std::vector<const hot_entry*> entries;
+			for ( auto& [key, entry] : map )
+				entries.emplace_back( &entry );
+			size_t n = std::min( top_n, entries.size() );
+			std::partial_sort( entries.begin(), entries.begin() + n, entries.end(), [ ] ( auto* a, auto* b ) { return a->count > b->count; } );
+
+			std::string out = "[";
+			for ( size_t i = 0; i != n; i++ )
+				out += format::str( "%s{\"name\":%s,\"count\":%llu}", i ? "," : "", quote( entries[ i ]->name ), entries[ i ]->count );
+			return out + "]";
+		};
+
+		std::string out = "{\"enabled\":";
+		out += VTIL_OPT_TRACE_STATISTICS ? "true" : "false";
+		for ( auto [name, counter] : zip( counter_names, counters ) )
+			out += format::str( ",\"%s\":%llu", name, counter.load() );
+		out += format::str( ",\"trace_time_ns\":%llu,\"rtrace_time_ns\":%llu", trace_time_ns.load(), rtrace_time_ns.load() );
+
+		out += ",\"rtrace_depth_histogram\":[";
+		for ( size_t i = 0; i != depth_bucket_count; i++ )
+			out += format::str( "%s%llu", i ? "," : "", depth_histogram[ i ].load() );
+		out += "]";
+
+		std::lock_guard _g( mtx );
+		out += ",\"hot_variables\":" + list_top( variables );
+		out += ",\"hot_blocks\":" + list_top( blocks );
+		return out + "}";
+	}
+};
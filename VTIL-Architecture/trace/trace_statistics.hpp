@@ -0,0 +1,161 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vtil/utility>
+#include <array>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "../symex/variable.hpp"
+
+// [Configuration]
+// Determine whether we should collect statistics about the variable tracing process.
+//
+#ifndef VTIL_OPT_TRACE_STATISTICS
+	#define VTIL_OPT_TRACE_STATISTICS 0
+#endif
+
+namespace vtil
+{
+	// Process-wide statistics of the tracers, only collected if VTIL_OPT_TRACE_STATISTICS is set.
+	//
+	struct trace_statistics
+	{
+		// Event counters.
+		//
+		enum counter_id : size_t
+		{
+			trace_calls,
+			rtrace_calls,
+			cache_hits,
+			cache_partial_hits,
+			cache_misses,
+			cache_waits,
+			summary_hits,
+			summary_misses,
+			paths_explored,
+			paths_aborted_loop,
+			paths_failed,
+			paths_nondeterministic,
+			budget_blocks_exhausted,
+			budget_depth_exhausted,
+			budget_time_exhausted,
+			counter_max
+		};
+		static constexpr std::array counter_names = {
+			"trace_calls",
+			"rtrace_calls",
+			"cache_hits",
+			"cache_partial_hits",
+			"cache_misses",
+			"cache_waits",
+			"summary_hits",
+			"summary_misses",
+			"paths_explored",
+			"paths_aborted_loop",
+			"paths_failed",
+			"paths_nondeterministic",
+			"budget_blocks_exhausted",
+			"budget_depth_exhausted",
+			"budget_time_exhausted",
+		};
+		static_assert( counter_names.size() == counter_max, "Counter names are not complete." );
+
+		// Number of buckets in the recursion depth histogram, last one collects all deeper calls.
+		//
+		static constexpr size_t depth_bucket_count = 32;
+
+		// Number of times a single variable or block was traced.
+		//
+		struct hot_entry
+		{
+			std::string name;
+			uint64_t count = 0;
+		};
+
+		std::array<relaxed_atomic<uint64_t>, counter_max> counters = {};
+		std::array<relaxed_atomic<uint64_t>, depth_bucket_count> depth_histogram = {};
+
+		// Total time spent in the outermost trace and rtrace calls of each thread.
+		//
+		relaxed_atomic<uint64_t> trace_time_ns = 0;
+		relaxed_atomic<uint64_t> rtrace_time_ns = 0;
+
+		// Primitive traces by variable and by block.
+		//
+		relaxed<std::mutex> mtx;
+		std::unordered_map<hash_t, hot_entry> variables;
+		std::unordered_map<vip_t, hot_entry> blocks;
+
+		// Current nesting of each kind of call and the depth of rtrace recursion on this thread.
+		//
+		inline static thread_local size_t trace_nesting = 0;
+		inline static thread_local size_t rtrace_nesting = 0;
+		inline static thread_local size_t rtrace_depth = 0;
+
+		// Returns the global instance.
+		//
+		static trace_statistics& global()
+		{
+			static trace_statistics instance = {};
+			return instance;
+		}
+
+		// Recording helpers.
+		//
+		void count( counter_id id, uint64_t n = 1 ) { counters[ id ] += n; }
+		void record_depth( size_t depth ) { depth_histogram[ std::min( depth, depth_bucket_count - 1 ) ]++; }
+		void record_trace( const symbolic::variable& var );
+
+		// Times the outermost call of the given kind on the current thread.
+		//
+		struct scoped_timer
+		{
+			relaxed_atomic<uint64_t>* total = nullptr;
+			size_t& nesting;
+			timestamp_t t0;
+
+			scoped_timer( relaxed_atomic<uint64_t>& total, size_t& nesting )
+				: total( nesting++ ? nullptr : &total ), nesting( nesting ), t0( time::now() ) {}
+			~scoped_timer()
+			{
+				nesting--;
+				if ( total )
+					*total += std::chrono::duration_cast<time::nanoseconds>( time::now() - t0 ).count();
+			}
+		};
+
+		// Resets all statistics.
+		//
+		void reset();
+
+		// Dumps the statistics as a JSON object, listing the [top_n] most traced variables and blocks.
+		//
+		std::string to_json( size_t top_n = 16 );
+	};
+};
@@ -29,6 +29,10 @@
 #include <vtil/io>
 #include "../vm/lambda.hpp"
 #include <vtil/utility>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <exception>
 
 namespace vtil
 {
@@ -36,6 +40,233 @@ namespace vtil
 	//
 	using path_map_t = std::map<std::pair<const basic_block*, const basic_block*>, int>;
 
+	// State of the budget of the outermost rtrace call on the current thread, or of a single
+	// path forked from it in which case the hits are reported to the parent once joined.
+	//
+	struct budget_state
+	{
+		tracer* owner;
+		budget_state* parent = nullptr;
+		size_t max_blocks = 0;
+		size_t blocks = 0;
+		timestamp_t deadline = {};
+		bool exhausted = false;
+		trace_budget::limit_id limit = trace_budget::limit_max;
+	};
+	static thread_local budget_state* active_budget = nullptr;
+
+	// Marks the active budget exhausted due to the given limit.
+	//
+	static void exhaust_budget( trace_budget::limit_id limit )
+	{
+		if ( std::exchange( active_budget->exhausted, true ) )
+			return;
+		active_budget->limit = limit;
+		if ( active_budget->parent )
+			return;
+		active_budget->owner->budget_hits[ limit ]++;
+#if VTIL_OPT_TRACE_STATISTICS
+		trace_statistics::global().count( trace_statistics::counter_id( trace_statistics::budget_blocks_exhausted + limit ) );
+#endif
+	}
+
+	// Consumes the budget for exploring the predecessors of a block, returns false if exhausted.
+	//
+	static bool consume_budget()
+	{
+		if ( !active_budget )
+			return true;
+		if ( active_budget->exhausted )
+			return false;
+
+		auto& budget = active_budget->owner->budget;
+		if ( active_budget->max_blocks && ++active_budget->blocks > active_budget->max_blocks )
+			exhaust_budget( trace_budget::blocks );
+		else if ( budget.max_time.count() && time::now() > active_budget->deadline )
+			exhaust_budget( trace_budget::time );
+		return !active_budget->exhausted;
+	}
+
+	// Checks whether the expression is within the depth limit of the active budget.
+	//
+	static bool check_depth( const symbolic::expression::reference& exp )
+	{
+		if ( !active_budget || !exp )
+			return true;
+		size_t max_depth = active_budget->owner->budget.max_depth;
+		if ( max_depth && exp->depth > max_depth )
+		{
+			exhaust_budget( trace_budget::depth );
+			return false;
+		}
+		return true;
+	}
+
+	// Returns whether the budget of the current rtrace was exhausted, results of such calls
+	// depend on the budget and should not be memoized.
+	//
+	bool tracer::is_budget_exhausted()
+	{
+		return active_budget && active_budget->exhausted;
+	}
+
+	// Result of exploring a single path.
+	//
+	struct path_result
+	{
+		enum : uint8_t { skipped, degraded, taken } state;
+		symbolic::expression::reference result = {};
+	};
+
+	// Set on the threads exploring a forked path, which do not fork any further.
+	//
+	static thread_local bool in_forked_path = false;
+
+	// Simplifier states of the forked paths, reused across forks to keep the caches warm.
+	//
+	static std::mutex fork_state_mutex;
+	static std::vector<symbolic::simplifier_state_ptr> fork_states;
+
+	// Explores the paths on the task pool with a copy of the path history each, returns the 
+	// results in the original order of the paths. The remaining block budget is split between
+	// the paths deterministically so that the result does not depend on the scheduling.
+	//
+	template<typename F>
+	static std::vector<path_result> explore_parallel( const std::vector<il_const_iterator>& paths, const path_map_t& path_map, F&& explore )
+	{
+		std::vector<path_result> results( paths.size(), path_result{ path_result::skipped } );
+		std::vector<std::exception_ptr> errors( paths.size() );
+
+		// Capture the thread-local state of the current trace.
+		//
+		budget_state* budget = active_budget;
+		size_t traces = tracer::active_traces;
+#if VTIL_OPT_TRACE_STATISTICS
+		size_t depth = trace_statistics::rtrace_depth;
+#endif
+
+		// Create the budget of each path, a path left without any blocks starts exhausted.
+		//
+		std::vector<budget_state> budgets;
+		if ( budget )
+		{
+			size_t remaining = budget->max_blocks - std::min( budget->blocks, budget->max_blocks );
+			for ( size_t n = 0; n != paths.size(); n++ )
+			{
+				budget_state& state = budgets.emplace_back( budget_state{ .owner = budget->owner, .parent = budget, .deadline = budget->deadline } );
+				if ( budget->max_blocks )
+				{
+					state.max_blocks = remaining / paths.size() + ( n < ( remaining % paths.size() ) ? 1 : 0 );
+					if ( !state.max_blocks )
+					{
+						state.exhausted = true;
+						state.limit = trace_budget::blocks;
+					}
+				}
+			}
+		}
+
+		// Explores a single path with the thread-local state of the current trace, saving the 
+		// previous one as the thread may be pooled. A forked path never waits on a trace owned 
+		// by another thread if the forking thread could be the owner.
+		//
+		const auto fork = [ & ] ( size_t n )
+		{
+			bool prev_recursive = std::exchange( tracer::recursive_flag, true );
+			bool prev_forked = std::exchange( in_forked_path, true );
+			budget_state* prev_budget = std::exchange( active_budget, budget ? &budgets[ n ] : nullptr );
+			size_t prev_traces = std::exchange( tracer::active_traces, traces );
+#if VTIL_OPT_TRACE_STATISTICS
+			size_t prev_depth = std::exchange( trace_statistics::rtrace_depth, depth );
+#endif
+			finally _r( [ & ] ()
+			{
+				tracer::recursive_flag = prev_recursive;
+				in_forked_path = prev_forked;
+				active_budget = prev_budget;
+				tracer::active_traces = prev_traces;
+#if VTIL_OPT_TRACE_STATISTICS
+				trace_statistics::rtrace_depth = prev_depth;
+#endif
+			} );
+
+			// Swap in a pooled simplifier state if there is any.
+			//
+			symbolic::simplifier_state_ptr state = nullptr;
+			{
+				std::lock_guard _g( fork_state_mutex );
+				if ( !fork_states.empty() )
+				{
+					state = std::move( fork_states.back() );
+					fork_states.pop_back();
+				}
+			}
+			if ( state )
+				state = symbolic::swap_simplifier_state( std::move( state ) );
+
+			// Explore the path with a copy of the history.
+			//
+			try
+			{
+				path_map_t history = path_map;
+				results[ n ] = explore( paths[ n ], history );
+			}
+			catch ( ... )
+			{
+				errors[ n ] = std::current_exception();
+			}
+
+			// Swap the simplifier state back out and return it to the pool.
+			//
+			if ( state = symbolic::swap_simplifier_state( std::move( state ) ) )
+			{
+				std::lock_guard _g( fork_state_mutex );
+				fork_states.emplace_back( std::move( state ) );
+			}
+		};
+
+		// Let the workers and the calling thread pull the next path until none is left.
+		//
+		std::atomic<size_t> next = 0;
+		const auto work = [ & ] ()
+		{
+			for ( size_t n; ( n = next++ ) < paths.size(); )
+				fork( n );
+		};
+		{
+			size_t worker_count = std::min<size_t>( paths.size(), std::max( std::thread::hardware_concurrency(), 1u ) ) - 1;
+			std::vector<task::instance> tasks;
+			tasks.reserve( worker_count );
+			for ( size_t n = 0; n != worker_count; n++ )
+				tasks.emplace_back( work );
+			work();
+		}
+
+		// Account the blocks explored by the paths and report the first exhausted one in the 
+		// original order to the budget of the current trace.
+		//
+		if ( budget )
+		{
+			for ( auto& state : budgets )
+				budget->blocks += state.blocks;
+			for ( auto& state : budgets )
+			{
+				if ( state.exhausted )
+				{
+					exhaust_budget( state.limit );
+					break;
+				}
+			}
+		}
+
+		// Propagate the first exception if any.
+		//
+		for ( auto& error : errors )
+			if ( error )
+				std::rethrow_exception( error );
+		return results;
+	}
+
 	// Forward defs.
 	//
 	static symbolic::expression::reference rtrace_primitive( const symbolic::variable& lookup, tracer* tracer, path_map_t& path_map, const basic_block* target );
@@ -288,6 +519,14 @@ namespace vtil
 		//
 		bool initial_call = path_map.empty();
 
+#if VTIL_OPT_TRACE_STATISTICS
+		// Record the recursion depth.
+		//
+		auto& stats = trace_statistics::global();
+		stats.record_depth( trace_statistics::rtrace_depth++ );
+		struct depth_guard { ~depth_guard() { trace_statistics::rtrace_depth--; } } _d;
+#endif
+
 		// Trace through the current block first.
 		//
 		auto result = tracer->trace( lookup );
@@ -301,14 +540,33 @@ namespace vtil
 			symbolic::expression::reference default_result = {};
 			std::swap( result, default_result );
 
+			// Determine whether we're in a loop or not, if not the result does not depend on the
+			// path taken to reach this block so try to use the summary memoized by the tracer.
+			//
+			bool potential_loop = lookup.at.is_valid() && lookup.at.block->owner->is_looping( lookup.at.block );
+			std::optional<symbolic::expression::reference> summary;
+			if ( lookup.at.is_valid() && !potential_loop )
+			{
+				summary = tracer->find_summary( lookup );
+#if VTIL_OPT_TRACE_STATISTICS
+				stats.count( summary ? trace_statistics::summary_hits : trace_statistics::summary_misses );
+#endif
+			}
+
 			// If there may be paths to enumerate:
 			//
 			size_t count = 0;
-			if ( lookup.at.is_valid() )
+			if ( summary )
 			{
-				// Determine whether we're in a loop or not.
+#if VTIL_OPT_TRACE_VERBOSE
+				// Log the summary.
 				//
-				bool potential_loop = lookup.at.block->owner->is_looping( lookup.at.block );
+				log<CON_BLU>( "= %s [Path summary]\n", *summary );
+#endif
+				result = std::move( *summary );
+			}
+			else if ( lookup.at.is_valid() && consume_budget() )
+			{
 
 				// If block does not touch our variable, skip the logic.
 				//
@@ -322,9 +580,9 @@ namespace vtil
 				for ( auto& it : it_list )
 					potential_loop |= it.block == lookup.at.block;*/
 
-				// Enumerate each path:
+				// Explores a single path with the given history.
 				//
-				lookup.at.enum_paths( false, [ & ] ( const il_const_iterator& it )
+				const auto explore = [ & ] ( const il_const_iterator& it, path_map_t& history ) -> path_result
 				{
 					// Skip if it does not reach target.
 					//
@@ -336,22 +594,11 @@ namespace vtil
 					}
 #endif
 
-					// Increment path count.
-					//
-					if ( ++count == 0 )
-					{
-#if VTIL_OPT_TRACE_VERBOSE
-						// Log recursive tracing of the expression.
-						//
-						log<CON_GRN>( "Base case: %s\n", result );
-#endif
-					}
-
 					// If we've taken this path more than twice, skip it.
 					//
 					if ( potential_loop )
 					{
-						int& counter = path_map[ { lookup.at.block, it.block } ];
+						int& counter = history[ { lookup.at.block, it.block } ];
 						if ( counter >= 2 )
 						{
 #if VTIL_OPT_TRACE_VERBOSE
@@ -359,7 +606,10 @@ namespace vtil
 							//
 							log<CON_CYN>( "Path [%llx->%llx] is not taken as it's n-looping.\n", lookup.at.block->entry_vip, it.block->entry_vip );
 #endif
-							return enumerator::ocontinue;
+#if VTIL_OPT_TRACE_STATISTICS
+							stats.count( trace_statistics::paths_aborted_loop );
+#endif
+							return { path_result::skipped };
 						}
 						++counter;
 					}
@@ -369,22 +619,56 @@ namespace vtil
 					//
 					log<CON_YLW>( "Taking path [%llx->%llx]\n", lookup.at.block->entry_vip, it.block->entry_vip );
 #endif
+#if VTIL_OPT_TRACE_STATISTICS
+					stats.count( trace_statistics::paths_explored );
+#endif
+					// If the budget is exhausted, degrade to the default result.
+					//
+					if ( tracer::is_budget_exhausted() )
+						return { path_result::degraded };
+
 					// Propagate each variable onto to the destination block, if total fail, skip path.
 					//
 					symbolic::expression::reference exp = default_result;
-					bool total_fail = propagate( exp, it, tracer, &path_map, target );
+					bool total_fail = propagate( exp, it, tracer, &history, target );
 					if ( potential_loop )
-						path_map[ { lookup.at.block, it.block } ]--;
+						history[ { lookup.at.block, it.block } ]--;
 					if ( total_fail )
-						return enumerator::ocontinue;
+					{
+#if VTIL_OPT_TRACE_STATISTICS
+						stats.count( trace_statistics::paths_failed );
+#endif
+						return { path_result::skipped };
+					}
 
 #if VTIL_OPT_TRACE_VERBOSE
 					// Log result.
 					//
 					log<CON_BLU>( "= %s\n", exp );
 #endif
+					// If the expression got too deep, degrade to the default result.
+					//
+					if ( !check_depth( exp ) )
+						return { path_result::degraded };
+					return { path_result::taken, std::move( exp ) };
+				};
+
+				// Merges the result of a path into the final result, returns whether the 
+				// remaining paths should be skipped.
+				//
+				const auto merge = [ & ] ( path_result&& path )
+				{
+					if ( path.state == path_result::skipped )
+						return false;
+					if ( path.state == path_result::degraded )
+					{
+						result = default_result;
+						return true;
+					}
+
 					// If no result is set yet, assign the current expression.
 					//
+					auto& exp = path.result;
 					if ( !result )
 						result = exp;
 
@@ -396,6 +680,9 @@ namespace vtil
 						// Log decision.
 						//
 						log<CON_RED>( "Halting tracer as it was not deterministic.\n" );
+#endif
+#if VTIL_OPT_TRACE_STATISTICS
+						stats.count( trace_statistics::paths_nondeterministic );
 #endif
 						// If result was null, return lookup.
 						//
@@ -418,16 +705,57 @@ namespace vtil
 								}
 							}, true, false );
 						}
-						return enumerator::obreak;
+						return true;
 					}
+					return false;
+				};
+
+				// Collect each path.
+				//
+				std::vector<il_const_iterator> paths;
+				lookup.at.enum_paths( false, [ & ] ( const il_const_iterator& it )
+				{
+					paths.emplace_back( it );
 					return enumerator::ocontinue;
 				} );
+				count = paths.size();
+
+				// If the tracer allows it and we're not already in a forked path, explore the paths in 
+				// parallel, otherwise serially, merging in the original order either way.
+				//
+				if ( tracer->parallel_paths && count >= tracer->parallel_paths && !in_forked_path )
+				{
+					for ( auto& path : explore_parallel( paths, path_map, explore ) )
+						if ( merge( std::move( path ) ) )
+							break;
+				}
+				else
+				{
+					for ( auto& it : paths )
+						if ( merge( explore( it, path_map ) ) )
+							break;
+				}
+			}
+
+			// If there were simply no paths to take, use default result instead.
+			//
+			if ( !summary )
+			{
+				if ( !result && count == 0 )
+					result = default_result;
+
+				// Save the summary if the result is path-independent and complete.
+				//
+				if ( lookup.at.is_valid() && !potential_loop && !tracer::is_budget_exhausted() )
+				{
+					if ( result ) result.simplify();
+					tracer->save_summary( lookup, result );
+				}
 			}
 
-			// If result is null, use default result instead if the call will reach the user,
-			// or if there were simply no paths to take.
+			// If result is null, use default result instead if the call will reach the user.
 			//
-			if ( !result && ( initial_call || count == 0 ) )
+			if ( !result && initial_call )
 				result = std::move( default_result );
 		}
 #if VTIL_OPT_TRACE_VERBOSE
@@ -445,6 +773,16 @@ namespace vtil
 	symbolic::expression::reference tracer::trace( const symbolic::variable& lookup )
 	{
 		using namespace logger;
+		thread_trace_calls++;
+
+#if VTIL_OPT_TRACE_STATISTICS
+		// Record the primitive trace.
+		//
+		auto& stats = trace_statistics::global();
+		trace_statistics::scoped_timer _t( stats.trace_time_ns, trace_statistics::trace_nesting );
+		stats.count( trace_statistics::trace_calls );
+		stats.record_trace( lookup );
+#endif
 
 		// If invalid/.begin() iterator or register with "no-trace" flags, return as is.
 		//
@@ -539,13 +877,104 @@ namespace vtil
 	//
 	symbolic::expression::reference tracer::rtrace( const symbolic::variable& lookup )
 	{
+		thread_trace_calls++;
+
+#if VTIL_OPT_TRACE_STATISTICS
+		// Record the call.
+		//
+		auto& stats = trace_statistics::global();
+		trace_statistics::scoped_timer _t( stats.rtrace_time_ns, trace_statistics::rtrace_nesting );
+		stats.count( trace_statistics::rtrace_calls );
+#endif
+		// If outermost call with a bounded budget, start accounting.
+		//
+		budget_state state = { .owner = this };
+		bool owns_budget = !active_budget && budget.is_bounded();
+		if ( owns_budget )
+		{
+			state.max_blocks = budget.max_blocks;
+			state.deadline = time::now() + budget.max_time;
+			active_budget = &state;
+		}
+
+		// Restore the thread-local state on exit, the budget points to this frame.
+		//
 		bool recursive_flag_prev = std::exchange( recursive_flag, true );
+		finally _r( [ & ] ()
+		{
+			recursive_flag = recursive_flag_prev;
+			if ( owns_budget )
+				active_budget = nullptr;
+		} );
+
 		path_map_t path_map = {};
-		auto exp = rtrace_primitive( lookup, this, path_map, lookup.at.block );
-		recursive_flag = recursive_flag_prev;
-		return exp;
+		return rtrace_primitive( lookup, this, path_map, lookup.at.block );
 	}
 	
+	// Traces every variable in the list, variables bound to the same block are resolved in a 
+	// single backward sweep.
+	//
+	std::vector<symbolic::expression::reference> tracer::trace_all( const std::vector<symbolic::variable>& lookups )
+	{
+		std::vector<symbolic::expression::reference> results( lookups.size() );
+
+		// Group the variables by the block they are bound to, base cases are traced as is.
+		//
+		std::unordered_map<const basic_block*, std::unordered_map<il_const_iterator, std::vector<size_t>, hasher<>>> groups;
+		for ( size_t n = 0; n != lookups.size(); n++ )
+		{
+			auto& lookup = lookups[ n ];
+			if ( lookup.at.is_begin() || ( lookup.is_register() && ( lookup.reg().flags & ( register_volatile | register_readonly ) ) ) )
+				results[ n ] = trace( lookup );
+			else
+				groups[ lookup.at.block ][ lookup.at ].emplace_back( n );
+		}
+
+		// For each block:
+		//
+		for ( auto& [blk, queries] : groups )
+		{
+			// Iterate the block backwards starting from the end.
+			//
+			std::vector<size_t> pending;
+			for ( il_const_iterator it = blk->end();; )
+			{
+				// Add each variable bound at this point to the pending list.
+				//
+				if ( auto qit = queries.find( it ); qit != queries.end() )
+					pending.insert( pending.end(), qit->second.begin(), qit->second.end() );
+				if ( it.is_begin() )
+					break;
+
+				// Step back and check if any pending variable is written by the instruction, if so 
+				// trace it right after the write which is equivalent to tracing it at the original 
+				// position since nothing in between writes to it.
+				//
+				il_const_iterator prev = std::prev( it );
+				std::erase_if( pending, [ & ] ( size_t n )
+				{
+					auto& lookup = lookups[ n ];
+					auto details = lookup.written_by( prev, this, recursive_flag );
+					if ( !details )
+						return false;
+
+					if ( details.is_unknown() )
+						results[ n ] = lookup.to_expression();
+					else
+						results[ n ] = trace( symbolic::variable{ lookup }.bind( it ) );
+					return true;
+				} );
+				it = prev;
+			}
+
+			// Trace the remaining variables from the beginning of the block.
+			//
+			for ( size_t n : pending )
+				results[ n ] = trace( symbolic::variable{ lookups[ n ] }.bind( blk->begin() ) );
+		}
+		return results;
+	}
+
 	// Wrappers around trace and rtrace that can trace an entire expression.
 	//
 	symbolic::expression::reference tracer::trace_exp( const symbolic::expression::reference& exp )
@@ -27,7 +27,11 @@
 //
 #pragma once
 #include <vtil/symex>
+#include <optional>
+#include <vector>
+#include <array>
 #include "../symex/variable.hpp"
+#include "trace_statistics.hpp"
 
 // [Configuration]
 // Determine whether we should log the details of the variable tracing process.
@@ -38,12 +42,70 @@
 
 namespace vtil
 {
+	// Limits on the cost of a single rtrace call, zero implies no limit. Once any limit is
+	// hit the remaining paths are not explored and the variables are left bound at the 
+	// beginning of the blocks they were traced to instead.
+	//
+	struct trace_budget
+	{
+		// Maximum number of blocks explored.
+		//
+		size_t max_blocks = 0;
+
+		// Maximum depth of the expressions propagated across blocks.
+		//
+		size_t max_depth = 0;
+
+		// Maximum wall-clock time.
+		//
+		timeunit_t max_time = {};
+
+		// Limit identifiers.
+		//
+		enum limit_id : size_t
+		{
+			blocks,
+			depth,
+			time,
+			limit_max
+		};
+
+		// Returns whether there is any limit set.
+		//
+		bool is_bounded() const { return max_blocks || max_depth || max_time.count(); }
+	};
+
 	// Basic tracer implementation.
 	//
 	struct tracer
 	{
 		inline static thread_local bool recursive_flag = false;
 
+		// Number of traces in progress on the current thread that may be awaited by others, a thread 
+		// that is already tracing a variable never waits on another to avoid lock cycles.
+		//
+		inline static thread_local size_t active_traces = 0;
+
+		// Number of trace and rtrace calls made on the current thread, used to attribute
+		// the tracing load to the callers.
+		//
+		inline static thread_local uint64_t thread_trace_calls = 0;
+
+		// Minimum number of predecessors for rtrace to explore them in parallel on the task pool,
+		// zero disables it. Paths explored by a forked task are not forked any further, derived
+		// tracers must be thread-safe if this is set.
+		//
+		size_t parallel_paths = 0;
+
+		// Budget of each outermost rtrace call and the number of times each of its limits was hit.
+		//
+		trace_budget budget = {};
+		std::array<relaxed_atomic<uint64_t>, trace_budget::limit_max> budget_hits = {};
+
+		// Returns whether the budget of the rtrace call in progress on this thread was exhausted.
+		//
+		static bool is_budget_exhausted();
+
 		// Traces a variable across the basic block it belongs to and generates a symbolic expression 
 		// that describes it's value at the bound point. The provided variable should not contain a 
 		// pointer with out-of-block expressions.
@@ -56,6 +118,12 @@ namespace vtil
 		//
 		virtual symbolic::expression::reference rtrace( const symbolic::variable& lookup );
 
+		// Traces every variable in the list, equivalent to invoking trace on each of them, but the
+		// variables bound to the same block are resolved in a single backward sweep over it which
+		// locates the instruction writing to each of them before tracing.
+		//
+		std::vector<symbolic::expression::reference> trace_all( const std::vector<symbolic::variable>& lookups );
+
 		// Wrappers around the functions above that return expressions with the registers packed.
 		//
 		symbolic::expression::reference trace_p( const symbolic::variable& lookup ) { return symbolic::variable::pack_all( trace( lookup ) ); }
@@ -68,10 +136,24 @@ namespace vtil
 		symbolic::expression::reference trace_pexp( const symbolic::expression::reference& exp ) { return symbolic::variable::pack_all( trace_exp( exp ) ); }
 		symbolic::expression::reference rtrace_pexp( const symbolic::expression::reference& exp ) { return symbolic::variable::pack_all( rtrace_exp( exp ) ); }
 
+		// Path summaries, rtrace results of variables in blocks that are not part of a loop do 
+		// not depend on the path taken to reach them, so they can be memoized by derived tracers 
+		// and composed along paths instead of being traced again. Null reference indicates a
+		// failed trace, nullopt indicates there is no summary.
+		//
+		virtual std::optional<symbolic::expression::reference> find_summary( const symbolic::variable& ) { return std::nullopt; }
+		virtual void save_summary( const symbolic::variable&, const symbolic::expression::reference& ) {}
+
 		// Purifies the tracer.
 		//
 		virtual tracer* purify() { return this; }
 
+		// Whether or not the results are those of the default tracing logic, which allows them to be 
+		// cached on the instructions. Derived tracers are assumed to alter the results unless they
+		// override this.
+		//
+		virtual bool is_pure() const { return typeid( *this ) == typeid( tracer ); }
+
 		// Operator() wraps basic tracing with packing.
 		//
 		auto operator()( const symbolic::variable& lookup ) { return trace_p( lookup ); }
@@ -0,0 +1,137 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#if _WIN64
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <Windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+#include "fileio.hpp"
+
+namespace vtil::file
+{
+#if _WIN64
+	// Maps the file at the given path, throws on failure.
+	//
+	mapped_view::mapped_view( const std::filesystem::path& path )
+	{
+		// Try to open the file for read.
+		//
+		HANDLE file = CreateFileW( path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+		if ( file == INVALID_HANDLE_VALUE ) fthrow( "File %s cannot be opened for read.", path );
+		file_handle = file;
+
+		// Determine the file length, if empty skip mapping.
+		//
+		LARGE_INTEGER file_size;
+		if ( !GetFileSizeEx( file, &file_size ) )
+		{
+			CloseHandle( file );
+			fthrow( "File %s cannot be opened for read.", path );
+		}
+		length = ( size_t ) file_size.QuadPart;
+		if ( !length ) return;
+
+		// Create a read-only mapping and map the whole file.
+		//
+		HANDLE mapping = CreateFileMappingW( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+		if ( !mapping )
+		{
+			CloseHandle( file );
+			fthrow( "File %s cannot be mapped.", path );
+		}
+		mapping_handle = mapping;
+		address = ( const uint8_t* ) MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+		if ( !address )
+		{
+			CloseHandle( mapping );
+			CloseHandle( file );
+			fthrow( "File %s cannot be mapped.", path );
+		}
+	}
+
+	// Unmaps the view.
+	//
+	mapped_view::~mapped_view()
+	{
+		if ( address )        UnmapViewOfFile( address );
+		if ( mapping_handle ) CloseHandle( mapping_handle );
+		if ( file_handle )    CloseHandle( file_handle );
+	}
+#else
+	// Maps the file at the given path, throws on failure.
+	//
+	mapped_view::mapped_view( const std::filesystem::path& path )
+	{
+		// Try to open the file for read.
+		//
+		int fd = open( path.c_str(), O_RDONLY );
+		if ( fd < 0 ) fthrow( "File %s cannot be opened for read.", path );
+
+		// Determine the file length, if empty skip mapping.
+		//
+		struct stat st;
+		if ( fstat( fd, &st ) != 0 )
+		{
+			close( fd );
+			fthrow( "File %s cannot be opened for read.", path );
+		}
+		length = ( size_t ) st.st_size;
+
+		// Map the whole file, the descriptor is no longer needed after mapping.
+		//
+		if ( length )
+		{
+			void* result = mmap( nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0 );
+			if ( result == MAP_FAILED )
+			{
+				close( fd );
+				fthrow( "File %s cannot be mapped.", path );
+			}
+			address = ( const uint8_t* ) result;
+		}
+		close( fd );
+	}
+
+	// Unmaps the view.
+	//
+	mapped_view::~mapped_view()
+	{
+		if ( address )
+			munmap( ( void* ) address, length );
+	}
+#endif
+};
\ No newline at end of file
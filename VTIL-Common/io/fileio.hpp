@@ -31,7 +31,9 @@
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <utility>
 #include "../io/logger.hpp"
+#include "../io/asserts.hpp"
 
 // Declare a simple interface to read/write files for convenience.
 //
@@ -94,6 +96,52 @@ namespace vtil::file
 		}
 	}
 
+	// Read-only memory mapped view of a file, empty files are represented by an empty view.
+	//
+	struct mapped_view
+	{
+		// Base address of the view and its length.
+		//
+		const uint8_t* address = nullptr;
+		size_t length = 0;
+
+		// Platform specific handles.
+		//
+		void* file_handle = nullptr;
+		void* mapping_handle = nullptr;
+
+		// Maps the file at the given path, throws on failure.
+		//
+		mapped_view( const std::filesystem::path& path );
+
+		// No copy, custom move.
+		//
+		mapped_view( mapped_view&& o ) noexcept
+			: address( std::exchange( o.address, nullptr ) ), length( std::exchange( o.length, 0 ) ),
+			  file_handle( std::exchange( o.file_handle, nullptr ) ), mapping_handle( std::exchange( o.mapping_handle, nullptr ) ) {}
+		mapped_view& operator=( mapped_view&& o ) noexcept
+		{
+			std::swap( address, o.address );
+			std::swap( length, o.length );
+			std::swap( file_handle, o.file_handle );
+			std::swap( mapping_handle, o.mapping_handle );
+			return *this;
+		}
+		mapped_view( const mapped_view& ) = delete;
+		mapped_view& operator=( const mapped_view& ) = delete;
+
+		// Unmaps the view.
+		//
+		~mapped_view();
+
+		// Container-like accessors.
+		//
+		const uint8_t* data() const { return address; }
+		size_t size() const { return length; }
+		const uint8_t* begin() const { return address; }
+		const uint8_t* end() const { return address + length; }
+	};
+
 	// String I/O.
 	//
 	template<typename C = char>
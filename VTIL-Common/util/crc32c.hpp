@@ -0,0 +1,159 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <array>
+#include <stdint.h>
+#include <string.h>
+
+// [Configuration]
+// Determine whether or not to use the SSE4.2 CRC32 instructions when the processor supports them,
+// only available on x86-64 targets, others always use the table implementation.
+//
+#ifndef VTIL_CRC32C_USE_HW
+	#if defined(__x86_64__) || defined(_M_X64)
+		#define VTIL_CRC32C_USE_HW true
+	#else
+		#define VTIL_CRC32C_USE_HW false
+	#endif
+#endif
+
+#if VTIL_CRC32C_USE_HW
+	#ifdef _MSC_VER
+		#include <intrin.h>
+		#include <nmmintrin.h>
+	#else
+		#include <nmmintrin.h>
+		#include <cpuid.h>
+	#endif
+#endif
+
+namespace vtil
+{
+	namespace impl
+	{
+		// Reflected Castagnoli polynomial.
+		//
+		static constexpr uint32_t crc32c_polynomial = 0x82F63B78;
+
+		// Slice-by-8 lookup tables for the software fallback.
+		//
+		static constexpr auto crc32c_tables = [ ] ()
+		{
+			std::array<std::array<uint32_t, 256>, 8> tables = {};
+			for ( uint32_t n = 0; n != 256; n++ )
+			{
+				uint32_t crc = n;
+				for ( int k = 0; k != 8; k++ )
+					crc = ( crc & 1 ) ? ( crc >> 1 ) ^ crc32c_polynomial : ( crc >> 1 );
+				tables[ 0 ][ n ] = crc;
+			}
+			for ( uint32_t n = 0; n != 256; n++ )
+				for ( size_t k = 1; k != 8; k++ )
+					tables[ k ][ n ] = ( tables[ k - 1 ][ n ] >> 8 ) ^ tables[ 0 ][ tables[ k - 1 ][ n ] & 0xFF ];
+			return tables;
+		}();
+
+		// Software implementation.
+		//
+		static uint32_t crc32c_sw( uint32_t crc, const uint8_t* data, size_t length )
+		{
+			auto& t = crc32c_tables;
+			for ( ; length >= 8; length -= 8, data += 8 )
+			{
+				uint64_t v;
+				memcpy( &v, data, 8 );
+				v ^= crc;
+				crc = t[ 7 ][ v & 0xFF ]         ^ t[ 6 ][ ( v >> 8 ) & 0xFF ]  ^
+					  t[ 5 ][ ( v >> 16 ) & 0xFF ] ^ t[ 4 ][ ( v >> 24 ) & 0xFF ] ^
+					  t[ 3 ][ ( v >> 32 ) & 0xFF ] ^ t[ 2 ][ ( v >> 40 ) & 0xFF ] ^
+					  t[ 1 ][ ( v >> 48 ) & 0xFF ] ^ t[ 0 ][ v >> 56 ];
+			}
+			while ( length-- )
+				crc = ( crc >> 8 ) ^ t[ 0 ][ ( crc ^ *data++ ) & 0xFF ];
+			return crc;
+		}
+
+#if VTIL_CRC32C_USE_HW
+		// Hardware implementation, only invoked if the processor reports SSE4.2 support.
+		//
+#ifndef _MSC_VER
+		__attribute__( ( target( "sse4.2" ) ) )
+#endif
+		static uint32_t crc32c_hw( uint32_t crc, const uint8_t* data, size_t length )
+		{
+			uint64_t crc64 = crc;
+			for ( ; length >= 8; length -= 8, data += 8 )
+			{
+				uint64_t v;
+				memcpy( &v, data, 8 );
+				crc64 = _mm_crc32_u64( crc64, v );
+			}
+			crc = ( uint32_t ) crc64;
+			while ( length-- )
+				crc = _mm_crc32_u8( crc, *data++ );
+			return crc;
+		}
+
+		// Checks whether or not the processor implements the CRC32 instruction.
+		//
+		static bool crc32c_hw_supported()
+		{
+			static const bool supported = [ ] ()
+			{
+#ifdef _MSC_VER
+				int info[ 4 ];
+				__cpuid( info, 1 );
+				return ( info[ 2 ] & ( 1 << 20 ) ) != 0;
+#else
+				unsigned int eax, ebx, ecx, edx;
+				if ( !__get_cpuid( 1, &eax, &ebx, &ecx, &edx ) )
+					return false;
+				return ( ecx & bit_SSE4_2 ) != 0;
+#endif
+			}();
+			return supported;
+		}
+#else
+		static uint32_t crc32c_hw( uint32_t crc, const uint8_t* data, size_t length ) { return crc32c_sw( crc, data, length ); }
+		static bool crc32c_hw_supported() { return false; }
+#endif
+	};
+
+	// Calculates the CRC32-C (Castagnoli) checksum of the given buffer, can be chained
+	// by passing the result of the previous call as the seed.
+	//
+	static uint32_t crc32c( const void* data, size_t length, uint32_t seed = 0 )
+	{
+		uint32_t crc = ~seed;
+		if ( VTIL_CRC32C_USE_HW && impl::crc32c_hw_supported() )
+			crc = impl::crc32c_hw( crc, ( const uint8_t* ) data, length );
+		else
+			crc = impl::crc32c_sw( crc, ( const uint8_t* ) data, length );
+		return ~crc;
+	}
+};
@@ -26,6 +26,7 @@
 // POSSIBILITY OF SUCH DAMAGE.        
 //
 #include "auxiliaries.hpp"
+#include "liveness.hpp"
 #include <vtil/io>
 #include <vtil/math>
 
@@ -56,15 +57,24 @@ namespace vtil::optimizer::aux
 		return result;
 	}
 
-	// Helper to check if the current value stored in the variable is used by the routine.
+	// Helper to check if the current value stored in the variable is used by the routine, 
+	// continuing the search after [from] with the bits in [mask_0] still alive.
 	// TODO: Doesnt discard based on block offset!
 	//
-	bool is_used( const symbolic::variable& var, bool rec, tracer* tracer )
+	static bool is_used( const symbolic::variable& var, const il_const_iterator& from, uint64_t mask_0, bool rec, tracer* tracer )
 	{
 		// Assert variable is properly bound.
 		//
 		fassert( var.at.is_valid() );
 
+		// If recursive register query, consult the liveness analysis of the routine first.
+		//
+		if ( rec && var.is_register() )
+		{
+			if ( auto result = get_liveness( var.at.block->owner )->is_used( var, from, mask_0, true ) )
+				return *result;
+		}
+
 		// Save original recursion restriction.
 		//
 		bool is_restricted = !rec;
@@ -110,7 +120,6 @@ namespace vtil::optimizer::aux
 		//
 		bool is_used = false;
 		bool is_nr_dead = false;
-		uint64_t mask_0 = math::fill( var.bit_count() );
 		auto enumerator = [ &, mask = mask_0, skip_count = 0, local_var = var ]( const il_const_iterator& it ) mutable
 		{
 			const auto declare_used = [ & ] ()
@@ -205,7 +214,7 @@ namespace vtil::optimizer::aux
 
 		// Invoke the enumerator.
 		//
-		auto it = var.at;
+		auto it = from;
 		if ( is_restricted ) it.restrict_path();
 		var.at.block->owner->enumerate(
 			enumerator,
@@ -228,6 +237,100 @@ namespace vtil::optimizer::aux
 			   ( !var.is_register() || var.reg().is_global() );
 	}
 
+	// Helper to check if the current value stored in the variable is used by the routine.
+	//
+	bool is_used( const symbolic::variable& var, bool rec, tracer* tracer )
+	{
+		return is_used( var, var.at, math::fill( var.bit_count() ), rec, tracer );
+	}
+
+	// Constructs a sweep over the given block.
+	//
+	usage_sweep::usage_sweep( const basic_block* blk, bool rec, vtil::tracer* tracer )
+		: rec( rec ), ptracer( tracer ), tail( blk->empty() ? blk->end() : std::prev( blk->end() ) ), past_tail( blk->empty() ) {}
+
+	// Indexes the instruction by the registers it references.
+	//
+	void usage_sweep::visit( const il_const_iterator& it )
+	{
+		// If at or after the tail, skip.
+		//
+		if ( !past_tail )
+		{
+			past_tail = it == tail;
+			return;
+		}
+
+		// Real branches are handled by the generic search, so move the tail here and
+		// drop the instructions after it from the index.
+		//
+		if ( it->base->is_branching_real() )
+		{
+			tail = it;
+			accesses.clear();
+			return;
+		}
+
+		// Append the instruction to the list of each register it references.
+		//
+		for ( auto& op : it->operands )
+		{
+			if ( !op.is_register() )
+				continue;
+			auto& list = accesses[ op.reg().weaken() ];
+			if ( list.empty() || list.back() != it )
+				list.emplace_back( it );
+		}
+	}
+
+	// Checks if the value of the register written at the point it is bound to is used, every
+	// instruction after it must be visited already.
+	//
+	bool usage_sweep::is_used( const symbolic::variable& var )
+	{
+		// If not a register or the tail is not after the variable, use the generic search.
+		//
+		if ( !var.is_register() || var.at.is_end() || var.at == tail || std::next( var.at ) == tail )
+			return aux::is_used( var, rec, ptracer );
+
+		// Iterate every indexed instruction referencing the register starting from the closest.
+		//
+		uint64_t mask = math::fill( var.bit_count() );
+		if ( auto it = accesses.find( var.reg().weaken() ); it != accesses.end() )
+		{
+			for ( auto i = it->second.rbegin(); i != it->second.rend(); ++i )
+			{
+				// Check if variable is accessed by this instruction.
+				//
+				if ( auto details = var.accessed_by( *i, ptracer, rec ) )
+				{
+					// If possible read, declare used.
+					//
+					if ( details.read )
+					{
+						if ( details.is_unknown() || ( mask & math::fill( details.bit_count, details.bit_offset ) ) )
+							return true;
+					}
+					// If known overwrite, clear the mask.
+					//
+					else if ( details.write && !details.is_unknown() )
+					{
+						mask &= ~math::fill( details.bit_count, details.bit_offset );
+					}
+				}
+
+				// If value is dead, declare not used.
+				//
+				if ( !mask )
+					return false;
+			}
+		}
+
+		// Continue the generic search from the instruction before the tail with the remaining bits.
+		//
+		return aux::is_used( var, std::prev( tail ), mask, rec, ptracer );
+	}
+
 	// Helper to check if the given symbolic variable's value is preserved upto [dst].
 	//
 	bool is_alive( const symbolic::variable& var, const il_const_iterator& dst, bool rec, tracer* tracer )
@@ -64,6 +64,39 @@ namespace vtil::optimizer::aux
 	//
 	bool is_used( const symbolic::variable& var, bool rec, tracer* tracer );
 
+	// Resolves is_used queries for registers while sweeping a block backwards. Each instruction 
+	// visited is indexed by the registers it references so that a query only visits the instructions
+	// referencing the register instead of scanning the rest of the block, instructions modified after 
+	// being visited are still handled correctly as the accesses are resolved when queried.
+	//
+	struct usage_sweep
+	{
+		bool rec;
+		tracer* ptracer;
+
+		// Instructions at or after the tail are left to the generic search.
+		//
+		il_const_iterator tail;
+		bool past_tail;
+
+		// List of instructions referencing each register, closest one at the back.
+		//
+		std::unordered_map<register_desc::weak_id, std::vector<il_const_iterator>, hasher<>> accesses;
+
+		// Constructs a sweep over the given block.
+		//
+		usage_sweep( const basic_block* blk, bool rec, vtil::tracer* tracer );
+
+		// Indexes the instruction, must be invoked for every instruction in reverse order 
+		// starting from the end of the block.
+		//
+		void visit( const il_const_iterator& it );
+
+		// Equivalent of is_used for a variable bound to the instruction that will be visited next.
+		//
+		bool is_used( const symbolic::variable& var );
+	};
+
 	// Helper to check if the given symbolic variable's value is preserved upto [dst].
 	//
 	bool is_alive( const symbolic::variable& var, const il_const_iterator& dst, bool rec, tracer* tracer );
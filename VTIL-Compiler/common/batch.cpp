@@ -0,0 +1,208 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "batch.hpp"
+#include "apply_all.hpp"
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <map>
+#include <vtil/io>
+
+namespace vtil::optimizer
+{
+	// Estimates the memory footprint of a routine.
+	//
+	static size_t estimate_footprint( const routine* rtn )
+	{
+		size_t footprint = sizeof( routine );
+		for ( auto& [vip, blk] : rtn->explored_blocks )
+		{
+			footprint += sizeof( std::pair<vip_t, basic_block*> ) + sizeof( basic_block );
+			footprint += ( blk->prev.size() + blk->next.size() ) * sizeof( basic_block* );
+			for ( auto& ins : *blk )
+				footprint += sizeof( instruction ) + 2 * sizeof( void* ) + ins.operands.size() * sizeof( operand );
+		}
+		return footprint;
+	}
+
+	// Decodes and optimizes a single source.
+	//
+	static std::unique_ptr<routine> process_source( const batch_source& source, const batch_options& options, batch_statistics& stats )
+	{
+		// Decode the routine, mapping the file if a path is given.
+		//
+		std::unique_ptr<routine> rtn;
+		auto t0 = time::now();
+		size_t input_length;
+		{
+			std::optional<file::mapped_view> view;
+			if ( !source.data )
+				view.emplace( source.path );
+			byte_reader in = view ? byte_reader{ view->data(), view->size() } : byte_reader{ source.data, source.length };
+			input_length = view ? view->size() : source.length;
+
+			routine* result;
+			deserialize( in, result );
+			rtn.reset( result );
+		}
+		auto t1 = time::now();
+		stats.decode_time = t1 - t0;
+		stats.blocks_in = rtn->num_blocks();
+		stats.instructions_in = rtn->num_instructions();
+		stats.peak_memory = input_length + estimate_footprint( rtn.get() );
+
+		// Optimize the routine if requested.
+		//
+		if ( options.optimize )
+		{
+			if ( options.optimizer )
+				options.optimizer( rtn.get() );
+			else if ( options.optimize_budget.count() )
+				stats.optimize_expired = apply_timeboxed( rtn.get(), apply_all, options.optimize_budget ).expired;
+			else
+				apply_all( rtn.get() );
+			stats.optimize_time = time::now() - t1;
+			stats.peak_memory = std::max( stats.peak_memory, estimate_footprint( rtn.get() ) );
+		}
+		stats.blocks_out = rtn->num_blocks();
+		stats.instructions_out = rtn->num_instructions();
+		return rtn;
+	}
+
+	// Decodes and optimizes every source given in parallel.
+	//
+	batch_summary ingest_batch( const std::vector<batch_source>& sources, const batch_callback& callback, const batch_options& options )
+	{
+		// Determine the worker count and the in-flight limit.
+		//
+		size_t worker_count = options.worker_count ? options.worker_count : std::max( std::thread::hardware_concurrency(), 1u );
+		worker_count = std::min( worker_count, std::max<size_t>( sources.size(), 1 ) );
+		size_t max_in_flight = options.max_in_flight ? options.max_in_flight : worker_count;
+
+		// State shared between the workers, guarded by the mutex.
+		//
+		std::mutex mtx;
+		std::condition_variable cv;
+		size_t next_index = 0;
+		size_t next_delivery = 0;
+		size_t in_flight = 0;
+		std::map<size_t, std::pair<std::unique_ptr<routine>, batch_statistics>> pending;
+		std::exception_ptr callback_exception;
+		batch_summary summary = {};
+
+		// Delivers a result, lock should be held.
+		//
+		auto deliver = [ & ] ( std::unique_ptr<routine> rtn, const batch_statistics& stats )
+		{
+			in_flight--;
+			if ( callback_exception ) return;
+			( rtn ? summary.succeeded : summary.failed )++;
+			try
+			{
+				callback( std::move( rtn ), stats );
+			}
+			catch ( ... )
+			{
+				callback_exception = std::current_exception();
+				next_index = sources.size();
+			}
+		};
+
+		// Worker body, processes sources until there are none left.
+		//
+		auto worker = [ & ] ()
+		{
+			while ( true )
+			{
+				// Wait for a slot and acquire the next source.
+				//
+				size_t index;
+				{
+					std::unique_lock lock{ mtx };
+					cv.wait( lock, [ & ] () { return in_flight < max_in_flight || next_index >= sources.size(); } );
+					if ( next_index >= sources.size() )
+						return;
+					index = next_index++;
+					summary.peak_in_flight = std::max( summary.peak_in_flight, ++in_flight );
+				}
+
+				// Process the source.
+				//
+				batch_statistics stats = {};
+				stats.index = index;
+				std::unique_ptr<routine> rtn;
+				try
+				{
+					rtn = process_source( sources[ index ], options, stats );
+				}
+				catch ( const std::exception& ex )
+				{
+					rtn.reset();
+					stats.error = ex.what();
+				}
+
+				// Deliver the result, if ordered, buffer until every preceding result is delivered.
+				//
+				std::unique_lock lock{ mtx };
+				if ( !options.ordered )
+				{
+					deliver( std::move( rtn ), stats );
+				}
+				else
+				{
+					pending.emplace( index, std::pair{ std::move( rtn ), std::move( stats ) } );
+					while ( !pending.empty() && pending.begin()->first == next_delivery )
+					{
+						auto& [rtn, stats] = pending.begin()->second;
+						deliver( std::move( rtn ), stats );
+						pending.erase( pending.begin() );
+						next_delivery++;
+					}
+				}
+				cv.notify_all();
+			}
+		};
+
+		// Spawn the workers and wait for them to finish.
+		//
+		auto t0 = time::now();
+		{
+			std::vector<task::instance> workers;
+			workers.reserve( worker_count );
+			for ( size_t n = 0; n != worker_count; n++ )
+				workers.emplace_back( worker );
+		}
+		summary.total_time = time::now() - t0;
+
+		// Rethrow the exception thrown by the callback if any.
+		//
+		if ( callback_exception )
+			std::rethrow_exception( callback_exception );
+		return summary;
+	}
+};
\ No newline at end of file
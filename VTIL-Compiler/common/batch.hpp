@@ -0,0 +1,132 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vtil/arch>
+#include <functional>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Parallel ingestion of serialized routines: each routine is decoded and optimized 
+// on a shared pool of workers and handed to the caller as soon as it is ready.
+//
+namespace vtil::optimizer
+{
+	// Source of a routine in a batch, either a path or a buffer holding the serialized routine.
+	// - Buffers are not copied and should outlive the batch.
+	//
+	struct batch_source
+	{
+		std::filesystem::path path;
+		const void* data = nullptr;
+		size_t length = 0;
+
+		batch_source( std::filesystem::path path ) : path( std::move( path ) ) {}
+		batch_source( const char* path ) : path( path ) {}
+		batch_source( const void* data, size_t length ) : data( data ), length( length ) {}
+	};
+
+	// Statistics of a single routine in the batch.
+	//
+	struct batch_statistics
+	{
+		// Index of the source in the batch and the reason of failure if any.
+		//
+		size_t index = 0;
+		std::string error;
+
+		// Time spent decoding and optimizing the routine.
+		//
+		time::unit_t decode_time = {};
+		time::unit_t optimize_time = {};
+
+		// Number of blocks and instructions before and after the optimization.
+		//
+		size_t blocks_in = 0;
+		size_t instructions_in = 0;
+		size_t blocks_out = 0;
+		size_t instructions_out = 0;
+
+		// Estimated peak memory footprint of the routine, serialized input included.
+		//
+		size_t peak_memory = 0;
+
+		// Set if the optimization budget expired before the optimizer converged.
+		//
+		bool optimize_expired = false;
+	};
+
+	// Options controlling the batch.
+	//
+	struct batch_options
+	{
+		// Number of workers, defaults to the hardware concurrency.
+		//
+		size_t worker_count = 0;
+
+		// Maximum number of routines being processed or waiting to be delivered at a time, 
+		// workers stall until a slot is available. Defaults to the worker count.
+		//
+		size_t max_in_flight = 0;
+
+		// Whether or not results should be delivered in the order of the sources.
+		//
+		bool ordered = false;
+
+		// Optimizer applied to each routine, ::apply_all if not set. If [optimize] is 
+		// cleared, routines are only decoded.
+		//
+		bool optimize = true;
+		std::function<void( routine* )> optimizer;
+
+		// Time budget of the default optimizer for each routine, unlimited if zero.
+		//
+		time::unit_t optimize_budget = {};
+	};
+
+	// Summary of the whole batch.
+	//
+	struct batch_summary
+	{
+		size_t succeeded = 0;
+		size_t failed = 0;
+		size_t peak_in_flight = 0;
+		time::unit_t total_time = {};
+	};
+
+	// Callback receiving the results, invoked serially from the worker threads. Routine 
+	// is null if decoding or optimizing failed, in which case the error is reported in 
+	// the statistics. Exceptions thrown by the callback stop the batch and are rethrown.
+	//
+	using batch_callback = std::function<void( std::unique_ptr<routine> rtn, const batch_statistics& stats )>;
+
+	// Decodes and optimizes every source given in parallel.
+	//
+	batch_summary ingest_batch( const std::vector<batch_source>& sources, const batch_callback& callback, const batch_options& options = {} );
+};
\ No newline at end of file
@@ -29,10 +29,17 @@
 #include <algorithm>
 #include <functional>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <thread>
 #include <vtil/utility>
 #include <vtil/io>
 #include <vtil/symex>
 #include <vtil/arch>
+#include "liveness.hpp"
+#include "profiler.hpp"
 
 namespace vtil::optimizer
 {
@@ -47,6 +54,249 @@ namespace vtil::optimizer
 			saved_cache() { }
 			saved_cache( const saved_cache& o ) { fassert( !o.state ); }
 		};
+
+		// Set of blocks the passes applied to a routine are currently restricted to, 
+		// stored in the routine context, null if unrestricted.
+		//
+		struct block_filter
+		{
+			const path_set* blocks = nullptr;
+		};
+
+		// Set on the threads that should apply the passes serially, used by the drivers that
+		// already parallelize across routines.
+		//
+		inline thread_local bool serial_passes = false;
+
+		// Deadline of the passes applied to a routine, stored in the routine context. Once it
+		// expires the passes stop at the next block or pass boundary, recording what was skipped.
+		//
+		struct pass_deadline
+		{
+			timestamp_t deadline = timestamp_t::max();
+			relaxed_atomic<bool> expired = false;
+			relaxed_atomic<size_t> skipped_blocks = 0;
+			relaxed_atomic<size_t> interrupted_loops = 0;
+
+			relaxed<std::mutex> mtx;
+			std::vector<std::string> skipped_passes;
+
+			// Returns whether or not the deadline has expired.
+			//
+			bool check()
+			{
+				if ( deadline == timestamp_t::max() )
+					return false;
+				if ( expired )
+					return true;
+				if ( time::now() < deadline )
+					return false;
+				expired = true;
+				return true;
+			}
+
+			// Records a skipped pass.
+			//
+			void skip_pass( std::string name )
+			{
+				std::lock_guard _g{ mtx };
+				skipped_passes.emplace_back( std::move( name ) );
+			}
+		};
+
+		// Passes the routine through the optimizer unless the deadline has expired.
+		//
+		template<typename T>
+		static size_t xpass_unless_expired( routine* rtn )
+		{
+			auto& deadline = rtn->context.get<pass_deadline>();
+			if ( deadline.check() )
+			{
+				deadline.skip_pass( T{}.name() );
+				return 0;
+			}
+			return T{}.xpass( rtn );
+		}
+
+		// Runs the given routine pass until it returns 0, after an iteration that changed the routine 
+		// only the blocks it modified and their neighbours are revisited, once those converge an 
+		// unrestricted iteration confirms the fixpoint.
+		//
+		template<typename F>
+		static size_t exhaust_routine( routine* rtn, F&& fn )
+		{
+			auto& filter = rtn->context.get<block_filter>();
+			auto& deadline = rtn->context.get<pass_deadline>();
+			const path_set* outer = filter.blocks;
+
+			size_t cnt = 0;
+			path_set worklist;
+			bool restricted = false;
+			while ( true )
+			{
+				// Stop if the deadline has expired.
+				//
+				if ( deadline.check() )
+				{
+					deadline.interrupted_loops++;
+					break;
+				}
+
+				// Save the epochs of each block before running the passes.
+				//
+				std::unordered_map<const basic_block*, epoch_t> epochs;
+				epochs.reserve( rtn->num_blocks() );
+				rtn->for_each( [ & ] ( const basic_block* blk ) { epochs.emplace( blk, blk->epoch ); } );
+				epoch_t cfg_epoch = rtn->cfg_epoch;
+
+				// Run the passes over the worklist or the outer filter, restoring the outer
+				// filter even if a pass throws.
+				//
+				size_t n;
+				{
+					filter.blocks = restricted ? &worklist : outer;
+					auto _r = finally( [ & ] () { filter.blocks = outer; } );
+					n = fn( rtn );
+				}
+				cnt += n;
+
+				// If nothing changed, stop if it was unrestricted, otherwise confirm.
+				//
+				if ( !n )
+				{
+					if ( !restricted ) break;
+					restricted = false;
+					continue;
+				}
+
+				// If the control flow changed, revisit everything.
+				//
+				if ( rtn->cfg_epoch != cfg_epoch )
+				{
+					restricted = false;
+					continue;
+				}
+
+				// Enqueue every modified block and its neighbours, never leaving the outer filter.
+				//
+				worklist.clear();
+				auto enqueue = [ & ] ( const basic_block* blk )
+				{
+					if ( !outer || outer->contains( blk ) )
+						worklist.emplace( blk );
+				};
+				rtn->for_each( [ & ] ( const basic_block* blk )
+				{
+					if ( auto it = epochs.find( blk ); it != epochs.end() && it->second == blk->epoch )
+						return;
+					enqueue( blk );
+					for ( auto* prev : blk->prev ) enqueue( prev );
+					for ( auto* next : blk->next ) enqueue( next );
+				} );
+				restricted = !worklist.empty();
+			}
+			return cnt;
+		}
+
+		// Invokes the worker on each block in the depth ordered list given, as soon as the 
+		// neighbours it depends on (predecessors if forward, successors otherwise) that are 
+		// placed before it are processed, instead of waiting for every previous level.
+		//
+		template<typename F>
+		static void schedule_parallel( const std::vector<routine::depth_placement>& entries, bool fwd, F&& worker )
+		{
+			size_t count = entries.size();
+			size_t worker_count = std::min<size_t>( count, std::max( std::thread::hardware_concurrency(), 1u ) );
+
+			// If parallel transformation is disabled or if there is not enough work, process serially, 
+			// the list is already ordered so that dependencies come first.
+			//
+			if ( !VTIL_USE_PARALLEL_TRANSFORM || worker_count <= 1 || serial_passes )
+			{
+				for ( auto& entry : entries )
+					worker( make_mutable( entry.block ) );
+				return;
+			}
+
+			// Resolve the dependencies of each block, back edges are ignored like it is
+			// done when the list is built.
+			//
+			std::unordered_map<const basic_block*, size_t> positions;
+			positions.reserve( count );
+			for ( size_t i = 0; i != count; i++ )
+				positions.emplace( entries[ i ].block, i );
+
+			std::vector<size_t> pending( count );
+			std::vector<std::vector<size_t>> dependents( count );
+			for ( size_t i = 0; i != count; i++ )
+			{
+				for ( auto& dep : ( fwd ? entries[ i ].block->prev : entries[ i ].block->next ) )
+				{
+					if ( auto it = positions.find( dep ); it != positions.end() && it->second < i )
+					{
+						dependents[ it->second ].emplace_back( i );
+						pending[ i ]++;
+					}
+				}
+			}
+
+			// Queue the blocks with no dependencies, state below is guarded by the mutex.
+			//
+			std::mutex mtx;
+			std::condition_variable cv;
+			std::deque<size_t> ready;
+			size_t remaining = count;
+			std::exception_ptr exception;
+			for ( size_t i = 0; i != count; i++ )
+				if ( !pending[ i ] )
+					ready.emplace_back( i );
+
+			// Each worker pulls the next runnable block and releases its dependents once done.
+			//
+			auto work = [ & ] ()
+			{
+				std::unique_lock lock{ mtx };
+				while ( true )
+				{
+					cv.wait( lock, [ & ] () { return !ready.empty() || !remaining || exception; } );
+					if ( !remaining || exception )
+						return;
+
+					size_t i = ready.front();
+					ready.pop_front();
+					lock.unlock();
+					try
+					{
+						worker( make_mutable( entries[ i ].block ) );
+					}
+					catch ( ... )
+					{
+						lock.lock();
+						exception = std::current_exception();
+						cv.notify_all();
+						return;
+					}
+					lock.lock();
+
+					remaining--;
+					for ( size_t dependent : dependents[ i ] )
+						if ( !--pending[ dependent ] )
+							ready.emplace_back( dependent );
+					cv.notify_all();
+				}
+			};
+			{
+				std::vector<task::instance> tasks;
+				tasks.reserve( worker_count );
+				for ( size_t n = 0; n != worker_count; n++ )
+					tasks.emplace_back( work );
+			}
+
+			// Propagate any exception thrown by the worker.
+			//
+			if ( exception )
+				std::rethrow_exception( exception );
+		}
 	};
 
 	// Pass execution order.
@@ -95,11 +345,21 @@ namespace vtil::optimizer
 	template<typename T>
 	static auto apply_pass( routine* rtn, T* opt )
 	{
-		// Declare worker and allocate the final result.
+		// Declare worker and allocate the final result, skipping the blocks
+		// that are not in the active filter if any or once the deadline expires.
 		//
 		std::atomic<size_t> n = { 0 };
+		const path_set* filter = rtn->context.get<impl::block_filter>().blocks;
+		auto& deadline = rtn->context.get<impl::pass_deadline>();
 		auto worker = [ & ] ( basic_block* block )
 		{
+			if ( filter && !filter->contains( block ) )
+				return;
+			if ( deadline.check() )
+			{
+				deadline.skipped_blocks++;
+				return;
+			}
 			scope_simplifier_cache _s{ block };
 			n += opt->pass( block, true );
 		};
@@ -151,8 +411,15 @@ namespace vtil::optimizer
 			}
 			case execution_order::parallel:
 			{
-				// Invoke parallel transformation.
+				// Invoke parallel transformation unless the thread is restricted to serial passes, sharing
+				// the liveness snapshot taken before the pass.
 				//
+				if ( impl::serial_passes )
+				{
+					rtn->for_each( worker );
+					break;
+				}
+				auto _f = aux::freeze_liveness( rtn );
 				transform_parallel( rtn->explored_blocks, [ & ] ( const std::pair<const vip_t, basic_block*>& pair )
 				{
 					worker( pair.second );
@@ -162,33 +429,15 @@ namespace vtil::optimizer
 			case execution_order::parallel_bf:
 			case execution_order::parallel_df:
 			{
-				// Get depth ordered list.
-				//
-				auto entries = rtn->get_depth_ordered_list( T::exec_order == execution_order::parallel_bf );
-
-				// Begin segmentation loop.
+				// Schedule each block as soon as its dependencies are processed, freezing the liveness
+				// analysis for the duration of the pass.
 				//
-				auto it_begin = entries.begin();
-				while ( it_begin != entries.end() )
-				{
-					// Find the last iterator with matching dependency.
-					//
-					auto it_end = it_begin;
-					while ( it_end != entries.end() &&
-							it_end->level_dependency == it_begin->level_dependency )
-						it_end++;
-
-					// Queue segment for work.
-					//
-					transform_parallel( make_range( it_begin, it_end ), [ & ] ( const routine::depth_placement& entry )
-					{
-						return worker( make_mutable( entry.block ) );
-					} );
-
-					// Continue search from next segment.
-					//
-					it_begin = it_end;
-				}
+				auto _f = aux::freeze_liveness( rtn );
+				impl::schedule_parallel( 
+					rtn->get_depth_ordered_list( T::exec_order == execution_order::parallel_bf ),
+					T::exec_order == execution_order::parallel_bf,
+					worker
+				);
 				break;
 			}
 			default: 
@@ -242,8 +491,8 @@ namespace vtil::optimizer
 		}
 		size_t xpass( routine* rtn ) override
 		{
-			size_t n = T1{}.xpass( rtn );
-			n += combine_pass<Tx...>{}.xpass( rtn );
+			size_t n = impl::xpass_unless_expired<T1>( rtn );
+			n += impl::xpass_unless_expired<combine_pass<Tx...>>( rtn );
 			return n;
 		}
 		std::string name() override { return "(" + T1{}.name() + " + " + combine_pass<Tx...>{}.name() + ")"; }
@@ -282,17 +531,25 @@ namespace vtil::optimizer
 		//
 		size_t pass( basic_block* blk, bool xblock = false ) override
 		{ 
+			auto& deadline = blk->owner->context.get<impl::pass_deadline>();
 			size_t cnt = 0;
 			while ( size_t n = combine_pass<Tx...>{}.pass( blk, xblock ) )
+			{
 				cnt += n;
+				if ( deadline.check() )
+				{
+					deadline.interrupted_loops++;
+					break;
+				}
+			}
 			return cnt;
 		}
+
+		// Worklist driven looping until pass returns 0 or the deadline expires.
+		//
 		size_t xpass( routine* rtn ) override
 		{
-			size_t cnt = 0;
-			while ( size_t n = combine_pass<Tx...>{}.xpass( rtn ) )
-				cnt += n;
-			return cnt;
+			return impl::exhaust_routine( rtn, [ ] ( routine* rtn ) { return combine_pass<Tx...>{}.xpass( rtn ); } );
 		}
 		std::string name() override { return "exhaust{" + combine_pass<Tx...>{}.name() + "}"; }
 	};
@@ -372,13 +629,17 @@ namespace vtil::optimizer
 		std::string name() override { return T{}.name(); }
 	};
 
-	// Used to profile the pass.
+	// Used to profile the pass, records into the active pass profiler if there is one,
+	// logs each call otherwise.
 	//
 	template<typename T>
 	struct profile_pass : T
 	{
 		size_t pass( basic_block* blk, bool xblock = false ) override
 		{
+			if ( auto profiler = pass_profiler::current() )
+				return profiler->measure( T{}.name(), blk, [ & ] () { return T::pass( blk, xblock ); } );
+
 			if ( !xblock )
 				logger::log( "Block %08x => %-64s |", blk->entry_vip, T{}.name() );
 
@@ -390,6 +651,9 @@ namespace vtil::optimizer
 
 		size_t xpass( routine* rtn ) override
 		{
+			if ( auto profiler = pass_profiler::current() )
+				return profiler->measure( T{}.name(), rtn, [ & ] () { return T::xpass( rtn ); } );
+
 			logger::log( "Routine => %-64s            |", T{}.name() );
 			auto [cnt, time] = profile( [ & ] () { return T::xpass( rtn ); } );
 			logger::log( " Took %-10s (N=%d).\n", time, cnt );
@@ -426,4 +690,55 @@ namespace vtil::optimizer
 
 	template<template<typename...> typename modifier, typename compound>
 	using apply_each = typename impl::apply_each_opt_t<modifier, compound>::type;
+
+	// Result of a time-boxed optimization.
+	//
+	struct timebox_result
+	{
+		// Number of optimizations applied and the time it took.
+		//
+		size_t applied = 0;
+		time::unit_t elapsed = {};
+
+		// Whether the deadline expired, the passes that were skipped as a whole, number of 
+		// block level applications skipped and number of loops stopped before convergence.
+		//
+		bool expired = false;
+		std::vector<std::string> skipped_passes;
+		size_t skipped_blocks = 0;
+		size_t interrupted_loops = 0;
+	};
+
+	// Passes the routine through the optimizer given with a time budget, once it expires the 
+	// passes stop at the next block or pass boundary leaving a valid partially optimized routine.
+	// - Passes with a custom routine-level logic are not interrupted once they start.
+	//
+	template<typename T>
+	static timebox_result apply_timeboxed( routine* rtn, T&& opt, time::unit_t budget )
+	{
+		auto& deadline = rtn->context.get<impl::pass_deadline>();
+		fassert( deadline.deadline == timestamp_t::max() );
+
+		// Arm the deadline, make sure it's disarmed even if the passes throw.
+		//
+		timestamp_t t0 = time::now();
+		deadline.deadline = t0 + budget;
+		struct disarm_guard
+		{
+			impl::pass_deadline& deadline;
+			~disarm_guard() { deadline = {}; }
+		} _g{ deadline };
+
+		// Run the passes and report.
+		//
+		timebox_result result = {};
+		result.applied = opt.xpass( rtn );
+		result.elapsed = time::now() - t0;
+		result.expired = deadline.expired;
+		result.skipped_blocks = deadline.skipped_blocks;
+		result.interrupted_loops = deadline.interrupted_loops;
+		std::lock_guard _l{ deadline.mtx };
+		result.skipped_passes = std::move( deadline.skipped_passes );
+		return result;
+	}
 };
\ No newline at end of file
@@ -0,0 +1,426 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "liveness.hpp"
+#include <mutex>
+#include <algorithm>
+
+namespace vtil::optimizer::aux
+{
+	using register_set = liveness_analysis::register_set;
+	using block_summary = liveness_analysis::block_summary;
+	using access = liveness_analysis::access;
+
+	// Accessors for the register sets, which are implicitly zero past their end.
+	//
+	static uint64_t& bits_of( register_set& set, uint32_t id )
+	{
+		if ( set.size() <= id )
+			set.resize( id + 1, 0 );
+		return set[ id ];
+	}
+	static uint64_t bits_of( const register_set& set, uint32_t id )
+	{
+		return id < set.size() ? set[ id ] : 0;
+	}
+
+	// Returns the dense number of the register, assigning one if it has none yet.
+	//
+	static uint32_t number_register( liveness_analysis& analysis, const register_desc& reg )
+	{
+		auto [it, inserted] = analysis.register_ids.emplace( reg.weaken(), ( uint32_t ) analysis.registers.size() );
+		if ( inserted )
+			analysis.registers.emplace_back( reg.weaken() );
+		return it->second;
+	}
+
+	// Builds the summary of a single block.
+	//
+	static std::shared_ptr<const block_summary> summarize( const basic_block* blk, liveness_analysis& analysis )
+	{
+		auto summary = std::make_shared<block_summary>();
+		summary->epoch = blk->epoch;
+		summary->improper_end = !blk->empty() && blk->next.empty() && blk->back().base != &ins::vexit;
+		summary->exits_vm = blk->is_complete() && blk->back().base == &ins::vexit;
+
+		// Number every register referenced by the block and the positions of each instruction.
+		//
+		uint32_t position = 0;
+		for ( auto it = blk->begin(); !it.is_end(); ++it, ++position )
+		{
+			summary->positions.emplace( &*it, position );
+			for ( auto& op : it->operands )
+				if ( op.is_register() )
+					number_register( analysis, op.reg() );
+		}
+		summary->register_count = analysis.registers.size();
+
+		// Record the accesses in program order.
+		//
+		position = 0;
+		for ( auto it = blk->begin(); !it.is_end(); ++it, ++position )
+		{
+			// If real branch, accesses depend on the calling convention, record an approximation
+			// of every register and mark the instruction to be resolved per query.
+			//
+			if ( it->base->is_branching_real() )
+			{
+				summary->has_real_branch = true;
+				summary->real_branches.emplace( position, it );
+
+				for ( uint32_t id = 0; id != analysis.registers.size(); id++ )
+				{
+					symbolic::variable var = { it, register_desc{ analysis.registers[ id ], 64 } };
+					auto details = var.accessed_by( it, nullptr, false );
+					if ( !details )
+						continue;
+
+					access entry = { .position = position, .read = 0, .write = 0, .implicit = true };
+					if ( details.read )
+						entry.read = details.is_unknown() ? ~0ull : math::fill( details.bit_count, details.bit_offset );
+					else if ( details.write && !details.is_unknown() )
+						entry.write = math::fill( details.bit_count, details.bit_offset );
+					summary->accesses[ id ].emplace_back( entry );
+				}
+				continue;
+			}
+
+			// Otherwise merge the explicit operands by register.
+			//
+			for ( size_t i = 0; i < it->base->operand_count(); i++ )
+			{
+				if ( !it->operands[ i ].is_register() )
+					continue;
+				auto& reg = it->operands[ i ].reg();
+				auto& list = summary->accesses[ analysis.register_ids.at( reg.weaken() ) ];
+				if ( list.empty() || list.back().position != position )
+					list.push_back( { .position = position, .read = 0, .write = 0, .implicit = false } );
+
+				if ( it->base->operand_types[ i ] != operand_type::write )
+					list.back().read |= reg.get_mask();
+				if ( it->base->operand_types[ i ] >= operand_type::write )
+					list.back().write |= reg.get_mask();
+			}
+		}
+
+		// Fold the accesses backwards into the use and def sets.
+		//
+		for ( auto& [id, list] : summary->accesses )
+		{
+			uint64_t use = 0, def = 0;
+			for ( auto it = list.rbegin(); it != list.rend(); ++it )
+			{
+				use = ( use & ~it->write ) | it->read;
+				def |= it->write;
+			}
+			bits_of( summary->use, id ) = use;
+			bits_of( summary->def, id ) = def;
+		}
+		return summary;
+	}
+
+	// Checks if two summaries are equivalent from the perspective of the data flow.
+	//
+	static bool is_flow_equivalent( const block_summary& a, const block_summary& b )
+	{
+		const auto equal_sets = [ ] ( const register_set& x, const register_set& y )
+		{
+			for ( size_t n = 0; n != std::max( x.size(), y.size() ); n++ )
+				if ( bits_of( x, n ) != bits_of( y, n ) )
+					return false;
+			return true;
+		};
+		return a.improper_end == b.improper_end &&
+			   a.exits_vm == b.exits_vm &&
+			   equal_sets( a.use, b.use ) &&
+			   equal_sets( a.def, b.def );
+	}
+
+	// Computes the analysis for the routine, reusing the summaries of the blocks that were 
+	// not modified since the previous analysis if any.
+	//
+	std::shared_ptr<const liveness_analysis> liveness_analysis::compute( const routine* rtn, const liveness_analysis* prev )
+	{
+		std::lock_guard _g( rtn->mutex );
+
+		auto result = std::make_shared<liveness_analysis>();
+		result->epoch = rtn->epoch;
+		result->cfg_epoch = rtn->cfg_epoch;
+		if ( prev )
+		{
+			result->register_ids = prev->register_ids;
+			result->registers = prev->registers;
+		}
+
+		// Summarize each block, reusing the previous summary if not modified since.
+		//
+		bool flow_changed = !prev || prev->cfg_epoch != rtn->cfg_epoch;
+		const auto previous_summary = [ & ] ( const basic_block* blk ) -> const block_summary*
+		{
+			if ( !prev ) return nullptr;
+			auto it = prev->blocks.find( blk );
+			return it != prev->blocks.end() ? it->second.get() : nullptr;
+		};
+		for ( auto& [vip, blk] : rtn->explored_blocks )
+		{
+			auto* old = previous_summary( blk );
+			if ( old && old->epoch == blk->epoch )
+			{
+				result->blocks.emplace( blk, prev->blocks.at( blk ) );
+				continue;
+			}
+
+			auto summary = summarize( blk, *result );
+			if ( !old || !is_flow_equivalent( *old, *summary ) )
+				flow_changed = true;
+			result->blocks.emplace( blk, std::move( summary ) );
+		}
+
+		// Rebuild the summaries with real branches that did not cover every register.
+		//
+		for ( auto& [blk, summary] : result->blocks )
+		{
+			if ( !summary->has_real_branch || summary->register_count == result->registers.size() )
+				continue;
+			auto updated = summarize( blk, *result );
+			if ( !is_flow_equivalent( *summary, *updated ) )
+				flow_changed = true;
+			summary = std::move( updated );
+		}
+
+		// If the data flow is unchanged, reuse the previous solution.
+		//
+		if ( !flow_changed )
+		{
+			result->live_in = prev->live_in;
+			return result;
+		}
+
+		// Order the blocks in post-order from the entry point, so that successors are mostly
+		// visited before their predecessors, followed by any unreachable blocks.
+		//
+		std::vector<const basic_block*> order;
+		order.reserve( result->blocks.size() );
+		path_set visited;
+		visited.reserve( result->blocks.size() );
+		const auto visit_from = [ & ] ( const basic_block* root )
+		{
+			if ( !visited.emplace( root ).second )
+				return;
+			std::vector<std::pair<const basic_block*, size_t>> stack = { { root, 0 } };
+			while ( !stack.empty() )
+			{
+				auto& [blk, idx] = stack.back();
+				if ( idx != blk->next.size() )
+				{
+					const basic_block* succ = blk->next[ idx++ ];
+					if ( visited.emplace( succ ).second )
+						stack.emplace_back( succ, 0 );
+				}
+				else
+				{
+					order.emplace_back( blk );
+					stack.pop_back();
+				}
+			}
+		};
+		if ( rtn->entry_point )
+			visit_from( rtn->entry_point );
+		for ( auto& [vip, blk] : rtn->explored_blocks )
+			visit_from( blk );
+
+		// Iterate to the fixpoint.
+		//
+		for ( auto blk : order )
+			result->live_in[ blk ] = result->blocks.at( blk )->use;
+		for ( bool changed = true; changed; )
+		{
+			changed = false;
+			for ( auto blk : order )
+			{
+				auto& summary = *result->blocks.at( blk );
+				auto& in = result->live_in[ blk ];
+				for ( uint32_t id = 0; id != result->registers.size(); id++ )
+				{
+					uint64_t out = result->live_out( blk, id, true );
+					uint64_t value = bits_of( summary.use, id ) | ( out & ~bits_of( summary.def, id ) );
+					if ( value != bits_of( in, id ) )
+					{
+						bits_of( in, id ) = value;
+						changed = true;
+					}
+				}
+			}
+		}
+		return result;
+	}
+
+	// Returns the mask of bits of the register live at the end of the block.
+	//
+	uint64_t liveness_analysis::live_out( const basic_block* blk, uint32_t id, bool rec ) const
+	{
+		auto& summary = *blocks.at( blk );
+		if ( summary.improper_end )
+			return ~0ull;
+
+		// If not recursive, everything but non-global registers are live unless the block exits the virtual machine.
+		//
+		if ( !rec )
+			return ( !summary.exits_vm && register_desc{ registers[ id ], 64 }.is_global() ) ? ~0ull : 0;
+
+		// Otherwise merge the live-in sets of the successors.
+		//
+		uint64_t out = 0;
+		for ( const basic_block* succ : blk->next )
+			if ( auto it = live_in.find( succ ); it != live_in.end() )
+				out |= bits_of( it->second, id );
+		return out;
+	}
+
+	// Returns whether the live-out sets of the block may be outdated by the modifications since
+	// the analysis, which can only be the case for a snapshot frozen for a parallel pass.
+	//
+	bool liveness_analysis::is_stale( const basic_block* blk ) const
+	{
+		const routine* rtn = blk->owner;
+		epoch_t current = rtn->epoch;
+		if ( current == epoch )
+			return false;
+
+		// If the control flow changed, the blocks we know of may no longer exist.
+		//
+		if ( rtn->cfg_epoch != cfg_epoch )
+			return true;
+
+		// Collect the modified blocks and propagate backwards to every block reaching them.
+		//
+		std::lock_guard _g( stale_mtx );
+		if ( std::exchange( stale_epoch, current ) != current )
+		{
+			stale_blocks.clear();
+			std::vector<const basic_block*> stack;
+			for ( auto& [block, summary] : blocks )
+				if ( summary->epoch != block->epoch && stale_blocks.emplace( block ).second )
+					stack.emplace_back( block );
+			while ( !stack.empty() )
+			{
+				const basic_block* block = stack.back();
+				stack.pop_back();
+				for ( const basic_block* prev : block->prev )
+					if ( stale_blocks.emplace( prev ).second )
+						stack.emplace_back( prev );
+			}
+		}
+		return stale_blocks.contains( blk );
+	}
+
+	// Checks if the value of the register variable at [from] is used by the routine with the bits in 
+	// [mask] still alive, returns nullopt if the variable is not covered by the analysis.
+	//
+	std::optional<bool> liveness_analysis::is_used( const symbolic::variable& var, const il_const_iterator& from, uint64_t mask, bool rec ) const
+	{
+		if ( !var.is_register() || !from.is_valid() || from.is_end() )
+			return std::nullopt;
+
+		// Resolve the block, the instruction and the register, skipping blocks modified since 
+		// the analysis as the analysis may be a snapshot frozen for a parallel pass.
+		//
+		auto blk_it = blocks.find( from.block );
+		if ( blk_it == blocks.end() )
+			return std::nullopt;
+		auto& summary = *blk_it->second;
+		if ( summary.epoch != from.block->epoch )
+			return std::nullopt;
+		auto pos_it = summary.positions.find( &*from );
+		if ( pos_it == summary.positions.end() )
+			return std::nullopt;
+		auto& reg = var.reg();
+		auto id_it = register_ids.find( reg.weaken() );
+		if ( id_it == register_ids.end() )
+			return std::nullopt;
+
+		// Converts a mask of the full register into a mask relative to the variable.
+		//
+		const auto relative = [ & ] ( uint64_t bits ) { return ( bits >> reg.bit_offset ) & math::fill( reg.bit_count ); };
+		mask &= math::fill( reg.bit_count );
+
+		// Walk the accesses after the instruction.
+		//
+		if ( auto acc_it = summary.accesses.find( id_it->second ); acc_it != summary.accesses.end() )
+		{
+			auto& list = acc_it->second;
+			auto it = std::upper_bound( list.begin(), list.end(), pos_it->second, [ ] ( uint32_t pos, const access& entry ) { return pos < entry.position; } );
+			for ( ; it != list.end(); ++it )
+			{
+				// Resolve implicit accesses against the variable itself.
+				//
+				if ( it->implicit )
+				{
+					if ( auto details = var.accessed_by( summary.real_branches.at( it->position ), nullptr, false ) )
+					{
+						if ( details.read )
+						{
+							if ( details.is_unknown() || ( mask & math::fill( details.bit_count, details.bit_offset ) ) )
+								return true;
+						}
+						else if ( details.write && !details.is_unknown() )
+						{
+							mask &= ~math::fill( details.bit_count, details.bit_offset );
+						}
+					}
+				}
+				else
+				{
+					if ( mask & relative( it->read ) )
+						return true;
+					mask &= ~relative( it->write );
+				}
+
+				if ( !mask )
+					return false;
+			}
+		}
+
+		// Check against the bits live at the end of the block, which may depend on the blocks
+		// modified since the analysis if recursive.
+		//
+		if ( rec && is_stale( from.block ) )
+			return std::nullopt;
+		return ( mask & relative( live_out( from.block, id_it->second, rec ) ) ) != 0;
+	}
+
+	// Returns the liveness analysis of the routine, recomputed if it was modified since unless frozen.
+	//
+	std::shared_ptr<const liveness_analysis> get_liveness( const routine* rtn )
+	{
+		liveness_cache& cache = rtn->context.get<liveness_cache>();
+		std::lock_guard _g( cache.mtx );
+		if ( !cache.current || ( !cache.frozen && cache.current->epoch != rtn->epoch ) )
+			cache.current = liveness_analysis::compute( rtn, cache.current.get() );
+		return cache.current;
+	}
+};
@@ -0,0 +1,172 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vtil/arch>
+#include <vtil/symex>
+#include <memory>
+#include <vector>
+#include <optional>
+#include <unordered_map>
+#include <mutex>
+
+// Register liveness analysis over the control flow graph of a routine, computed once
+// per routine epoch and consulted by the liveness helpers before tracing.
+//
+namespace vtil::optimizer::aux
+{
+	struct liveness_analysis
+	{
+		// Liveness of each register is described by a mask of its bits, sets are indexed
+		// by the dense number assigned to each register (as a weak identifier).
+		//
+		using register_set = std::vector<uint64_t>;
+
+		// Bits read and overwritten by a single instruction.
+		//
+		struct access
+		{
+			uint32_t position;
+			uint64_t read;
+			uint64_t write;
+
+			// Set if implied by a real branch, in which case the masks are an approximation 
+			// for the full register and the exact access is resolved per query.
+			//
+			bool implicit;
+		};
+
+		// Summary of a single block, only rebuilt if the block is modified.
+		//
+		struct block_summary
+		{
+			// Epoch of the block the summary was built at and the number of registers
+			// the implicit accesses by real branches were resolved for.
+			//
+			epoch_t epoch = invalid_epoch;
+			size_t register_count = 0;
+			bool has_real_branch = false;
+
+			// Position of each instruction in the block.
+			//
+			std::unordered_map<const instruction*, uint32_t> positions;
+
+			// Real branches in the block by their position.
+			//
+			std::unordered_map<uint32_t, il_const_iterator> real_branches;
+
+			// Accesses to each register in program order.
+			//
+			std::unordered_map<uint32_t, std::vector<access>> accesses;
+
+			// Upward exposed reads and the overwritten bits of the whole block.
+			//
+			register_set use;
+			register_set def;
+
+			// Whether the block ends without a successor or a vexit, in which case
+			// everything is live at the end, and whether it exits the virtual machine.
+			//
+			bool improper_end = false;
+			bool exits_vm = false;
+		};
+
+		// Epoch and the control flow epoch of the routine the analysis was computed at.
+		//
+		epoch_t epoch = invalid_epoch;
+		epoch_t cfg_epoch = invalid_epoch;
+
+		// Dense numbering of the registers.
+		//
+		std::unordered_map<register_desc::weak_id, uint32_t, hasher<>> register_ids;
+		std::vector<register_desc::weak_id> registers;
+
+		// Summary of each block and the registers live at the beginning of each.
+		//
+		std::unordered_map<const basic_block*, std::shared_ptr<const block_summary>> blocks;
+		std::unordered_map<const basic_block*, register_set> live_in;
+
+		// Blocks modified since the analysis along with every block reaching them, whose live-out
+		// sets may thus be outdated, computed lazily for the routine epoch it is queried at.
+		//
+		mutable relaxed<std::mutex> stale_mtx;
+		mutable epoch_t stale_epoch = invalid_epoch;
+		mutable path_set stale_blocks;
+
+		// Computes the analysis for the routine, reusing the summaries of the blocks that were 
+		// not modified since the previous analysis if any.
+		//
+		static std::shared_ptr<const liveness_analysis> compute( const routine* rtn, const liveness_analysis* prev = nullptr );
+
+		// Returns the mask of bits of the register live at the end of the block.
+		//
+		uint64_t live_out( const basic_block* blk, uint32_t id, bool rec ) const;
+
+		// Returns whether the live-out sets of the block may be outdated by the modifications since
+		// the analysis, which can only be the case for a snapshot frozen for a parallel pass.
+		//
+		bool is_stale( const basic_block* blk ) const;
+
+		// Checks if the value of the register variable at [from] is used by the routine with the bits in 
+		// [mask] still alive, returns nullopt if the variable is not covered by the analysis.
+		//
+		std::optional<bool> is_used( const symbolic::variable& var, const il_const_iterator& from, uint64_t mask, bool rec ) const;
+		std::optional<bool> is_used( const symbolic::variable& var, bool rec ) const { return is_used( var, var.at, math::fill( var.bit_count() ), rec ); }
+	};
+
+	// Per-routine cache of the latest analysis, stored in the routine context.
+	//
+	struct liveness_cache
+	{
+		relaxed<std::mutex> mtx;
+		std::shared_ptr<const liveness_analysis> current;
+		size_t frozen = 0;
+	};
+
+	// Returns the liveness analysis of the routine, recomputed if it was modified since unless frozen.
+	//
+	std::shared_ptr<const liveness_analysis> get_liveness( const routine* rtn );
+
+	// Brings the analysis up to date and freezes it until the returned guard is destroyed, used
+	// by parallel passes so that the workers share a snapshot taken before the pass instead of
+	// recomputing it from blocks that other workers are modifying.
+	//
+	inline auto freeze_liveness( const routine* rtn )
+	{
+		get_liveness( rtn );
+		liveness_cache& cache = rtn->context.get<liveness_cache>();
+		{
+			std::lock_guard _g( cache.mtx );
+			cache.frozen++;
+		}
+		return finally( [ &cache ] ()
+		{
+			std::lock_guard _g( cache.mtx );
+			cache.frozen--;
+		} );
+	}
+};
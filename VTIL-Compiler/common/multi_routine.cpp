@@ -0,0 +1,157 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "multi_routine.hpp"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace vtil::optimizer
+{
+	// Splits the pipeline into the stages that are scheduled separately, running them one after 
+	// the other on a routine is equivalent to running the pipeline itself.
+	//
+	static std::vector<pipeline> split_stages( const pipeline& passes )
+	{
+		// Only the routine-level logic is used by xpass.
+		//
+		auto root = passes.root;
+		if ( root->type == pipeline::node_type::specialize )
+			root = root->operands[ 1 ];
+
+		// Split combinations into their parts.
+		//
+		std::vector<pipeline> stages;
+		if ( root->type == pipeline::node_type::combine )
+		{
+			for ( auto& operand : root->operands )
+				stages.emplace_back( operand );
+		}
+		else
+		{
+			stages.emplace_back( root );
+		}
+		return stages;
+	}
+
+	// Optimizes every routine given in parallel, the routines are modified in place.
+	//
+	multi_routine_summary optimize_routines( const std::vector<routine*>& routines, const multi_routine_options& options )
+	{
+		multi_routine_summary summary = {};
+		auto stages = split_stages( options.passes ? *options.passes : pipeline::preset( "default" ) );
+		auto shared_cache = options.share_simplifier_cache ? symbolic::make_shared_simplifier_cache( options.shared_cache_capacity ) : nullptr;
+		size_t worker_count = options.worker_count ? options.worker_count : std::max( std::thread::hardware_concurrency(), 1u );
+		worker_count = std::min( worker_count, std::max<size_t>( routines.size(), 1 ) );
+
+		// Queue of the jobs as pairs of the routine index and the stage, and the number of 
+		// routines not yet completed, guarded by the mutex.
+		//
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::deque<std::pair<size_t, size_t>> jobs;
+		size_t remaining = routines.size();
+		for ( size_t i = 0; i != routines.size(); i++ )
+			jobs.emplace_back( i, 0 );
+
+		// Worker body, processes jobs until every routine is completed.
+		//
+		auto worker = [ & ] ()
+		{
+			bool prev_serial = std::exchange( impl::serial_passes, !options.parallel_blocks );
+			auto prev_cache = symbolic::swap_shared_simplifier_cache( shared_cache );
+
+			std::unique_lock lock{ mtx };
+			while ( true )
+			{
+				cv.wait( lock, [ & ] () { return !jobs.empty() || !remaining; } );
+				if ( !remaining )
+					break;
+				auto [index, stage] = jobs.front();
+				jobs.pop_front();
+				lock.unlock();
+
+				// Run the stage.
+				//
+				size_t applied = 0;
+				std::optional<std::string> error;
+				try
+				{
+					applied = stages[ stage ].xpass( routines[ index ] );
+				}
+				catch ( const std::exception& ex )
+				{
+					error = ex.what();
+				}
+
+				// Queue the next stage of the routine in front of the others so that routines
+				// are completed as early as possible, or mark it as completed.
+				//
+				lock.lock();
+				summary.jobs++;
+				summary.applied += applied;
+				if ( error )
+				{
+					summary.failures.emplace_back( index, std::move( *error ) );
+					remaining--;
+				}
+				else if ( ++stage != stages.size() )
+				{
+					jobs.emplace_front( index, stage );
+				}
+				else
+				{
+					summary.succeeded++;
+					remaining--;
+				}
+				cv.notify_all();
+			}
+
+			lock.unlock();
+			symbolic::swap_shared_simplifier_cache( std::move( prev_cache ) );
+			impl::serial_passes = prev_serial;
+		};
+
+		// Spawn the workers and wait for them to finish.
+		//
+		auto t0 = time::now();
+		{
+			std::vector<task::instance> workers;
+			workers.reserve( worker_count );
+			for ( size_t n = 0; n != worker_count; n++ )
+				workers.emplace_back( worker );
+		}
+		summary.total_time = time::now() - t0;
+
+		// Report the throughput and the cache statistics.
+		//
+		double seconds = std::chrono::duration<double>( summary.total_time ).count();
+		summary.routines_per_second = seconds > 0 ? summary.succeeded / seconds : 0;
+		summary.shared_cache = symbolic::get_statistics( shared_cache );
+		return summary;
+	}
+};
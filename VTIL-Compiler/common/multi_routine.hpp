@@ -0,0 +1,91 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vtil/arch>
+#include <optional>
+#include <string>
+#include <vector>
+#include "pipeline.hpp"
+
+// Optimization of many routines at once on a single pool of workers, each routine is split 
+// into a job per stage of the pipeline so that small routines do not leave the workers idle 
+// while large ones are being processed.
+//
+namespace vtil::optimizer
+{
+	// Options controlling the optimization.
+	//
+	struct multi_routine_options
+	{
+		// Number of workers, defaults to the hardware concurrency.
+		//
+		size_t worker_count = 0;
+
+		// Pipeline applied to each routine, the "default" preset if not set. Each top-level pass
+		// of its routine-level logic is scheduled as a separate job.
+		//
+		std::optional<pipeline> passes;
+
+		// Whether or not the passes should still parallelize over the blocks of each routine, 
+		// off by default since the workers already keep the cores busy.
+		//
+		bool parallel_blocks = false;
+
+		// Whether or not the workers share the simplification results across routines, 
+		// useful when the routines belong to the same binary, and the capacity of the cache.
+		//
+		bool share_simplifier_cache = true;
+		size_t shared_cache_capacity = 1 << 16;
+	};
+
+	// Summary of the optimization.
+	//
+	struct multi_routine_summary
+	{
+		// Number of routines optimized, failures with the reason indexed by the routine and the
+		// number of jobs executed.
+		//
+		size_t succeeded = 0;
+		std::vector<std::pair<size_t, std::string>> failures;
+		size_t jobs = 0;
+
+		// Number of optimizations applied and the time it took.
+		//
+		size_t applied = 0;
+		time::unit_t total_time = {};
+		double routines_per_second = 0;
+
+		// Statistics of the shared simplifier cache.
+		//
+		symbolic::shared_simplifier_cache_statistics shared_cache = {};
+	};
+
+	// Optimizes every routine given in parallel, the routines are modified in place.
+	//
+	multi_routine_summary optimize_routines( const std::vector<routine*>& routines, const multi_routine_options& options = {} );
+};
@@ -0,0 +1,626 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "pipeline.hpp"
+#include "apply_all.hpp"
+#include <cctype>
+#include <mutex>
+#include <stdexcept>
+
+namespace vtil::optimizer
+{
+	using node =      pipeline::node;
+	using node_type = pipeline::node_type;
+	using node_ptr =  std::shared_ptr<const node>;
+
+	// Built-in presets described in the language, the collective ones are built from the
+	// compositions in apply_all.hpp instead so that "default" is equivalent to ::apply_all.
+	//
+	static const std::pair<const char*, const char*> builtin_presets[] =
+	{
+		// Triage preset, a single round of propagation without any symbolic rewriting
+		// or branch resolution by exhaustive tracing.
+		//
+		{
+			"fast",
+			"specialize( combine( stack_pinning, istack_ref_substitution, stack_propagation, exhaust( mov_propagation, register_renaming ) ),"
+			"            combine( stack_pinning, istack_ref_substitution, bblock_extension, core_local_propagation,"
+			"                     dead_code_elimination, branch_correction, stack_pinning ) )"
+		},
+	};
+
+	// Registers a preset under the given name, which expands into the pipeline it describes.
+	//
+	void pass_registry::add_preset( std::string name, std::string description )
+	{
+		std::unique_lock _g{ mtx };
+		presets.insert_or_assign( std::move( name ), std::move( description ) );
+	}
+
+	// Looks up a pass or a preset by name, returns null if not found.
+	//
+	const pass_registry::entry* pass_registry::find( std::string_view name ) const
+	{
+		std::shared_lock _g{ mtx };
+		auto it = entries.find( name );
+		return it != entries.end() ? &it->second : nullptr;
+	}
+	const pass_registry::entry* pass_registry::find( const std::type_info& type ) const
+	{
+		std::shared_lock _g{ mtx };
+		for ( auto& [name, entry] : entries )
+			if ( *entry.type == type )
+				return &entry;
+		return nullptr;
+	}
+	std::optional<std::string> pass_registry::find_preset( std::string_view name ) const
+	{
+		std::shared_lock _g{ mtx };
+		auto it = presets.find( name );
+		if ( it == presets.end() ) return std::nullopt;
+		return it->second;
+	}
+
+	// Lists the names of the registered passes and presets.
+	//
+	std::vector<std::string> pass_registry::list() const
+	{
+		std::shared_lock _g{ mtx };
+		std::vector<std::string> result;
+		for ( auto& [name, entry] : entries )
+			result.emplace_back( name );
+		return result;
+	}
+	std::vector<std::string> pass_registry::list_presets() const
+	{
+		std::shared_lock _g{ mtx };
+		std::vector<std::string> result;
+		for ( auto& [name, description] : presets )
+			result.emplace_back( name );
+		return result;
+	}
+
+	// Global registry, holding every built-in pass and preset.
+	//
+	pass_registry& pass_registry::global()
+	{
+		static pass_registry registry;
+		[[maybe_unused]] static const bool initialized = [ ] ()
+		{
+			registry.add<stack_pinning_pass>( "stack_pinning" );
+			registry.add<istack_ref_substitution_pass>( "istack_ref_substitution" );
+			registry.add<bblock_extension_pass>( "bblock_extension" );
+			registry.add<stack_propagation_pass>( "stack_propagation" );
+			registry.add<dead_code_elimination_pass>( "dead_code_elimination" );
+			registry.add<fast_dead_code_elimination_pass>( "fast_dead_code_elimination" );
+			registry.add<fast_local_dead_code_elimination_pass>( "fast_local_dead_code_elimination" );
+			registry.add<fast_reg_propagation_pass>( "fast_reg_propagation" );
+			registry.add<fast_mem_propagation_pass>( "fast_mem_propagation" );
+			registry.add<mov_propagation_pass>( "mov_propagation" );
+			registry.add<symbolic_rewrite_pass<true>>( "symbolic_rewrite" );
+			registry.add<symbolic_rewrite_pass<false>>( "symbolic_rewrite_if_smaller" );
+			registry.add<branch_correction_pass>( "branch_correction" );
+			registry.add<register_renaming_pass>( "register_renaming" );
+			for ( auto& [name, description] : builtin_presets )
+				registry.add_preset( name, description );
+			registry.add_preset( "collective_propagation", pipeline::from<collective_propagation_pass>( registry ).to_string() );
+			registry.add_preset( "core_local_propagation", pipeline::from<core_local_propagation_pass>( registry ).to_string() );
+			registry.add_preset( "collective_cross", pipeline::from<collective_cross_pass>( registry ).to_string() );
+			registry.add_preset( "collective_local", pipeline::from<collective_local_pass>( registry ).to_string() );
+			registry.add_preset( "default", pipeline::from<collective_pass>( registry ).to_string() );
+			return true;
+		}();
+		return registry;
+	}
+
+	// Combines the operands starting from the given index.
+	//
+	static size_t pass_range( const node& n, size_t first, basic_block* blk, bool xblock )
+	{
+		size_t cnt = 0;
+		for ( size_t i = first; i < n.operands.size(); i++ )
+			cnt += n.operands[ i ]->pass( blk, xblock );
+		return cnt;
+	}
+	static size_t xpass_range( const node& n, size_t first, routine* rtn )
+	{
+		auto& deadline = rtn->context.get<impl::pass_deadline>();
+		size_t cnt = 0;
+		for ( size_t i = first; i < n.operands.size(); i++ )
+		{
+			if ( deadline.check() )
+				deadline.skip_pass( n.operands[ i ]->name() );
+			else
+				cnt += n.operands[ i ]->xpass( rtn );
+		}
+		return cnt;
+	}
+	static std::string name_range( const node& n, size_t first )
+	{
+		if ( ( first + 1 ) == n.operands.size() )
+			return n.operands[ first ]->name();
+
+		std::string result = "(";
+		for ( size_t i = first; i < n.operands.size(); i++ )
+		{
+			if ( i != first ) result += " + ";
+			result += n.operands[ i ]->name();
+		}
+		return result + ")";
+	}
+
+	// Implementation of the pass interface, see the template combinators for the semantics.
+	//
+	size_t node::pass( basic_block* blk, bool xblock ) const
+	{
+		switch ( type )
+		{
+			case node_type::nop:         return 0;
+			case node_type::pass:        return entry->instances[ modifiers ].pass( blk, xblock );
+			case node_type::combine:     return pass_range( *this, 0, blk, xblock );
+			case node_type::conditional:
+			{
+				if ( !xblock )
+				{
+					size_t n = operands[ 0 ]->pass( blk, false );
+					if ( n ) n += pass_range( *this, 1, blk, false );
+					return n;
+				}
+				return operands[ 0 ]->pass( blk, true );
+			}
+			case node_type::exhaust:
+			{
+				auto& deadline = blk->owner->context.get<impl::pass_deadline>();
+				size_t cnt = 0;
+				while ( size_t n = pass_range( *this, 0, blk, xblock ) )
+				{
+					cnt += n;
+					if ( deadline.check() )
+					{
+						deadline.interrupted_loops++;
+						break;
+					}
+				}
+				return cnt;
+			}
+			case node_type::specialize:  return xblock ? operands[ 1 ]->pass( blk, true ) : operands[ 0 ]->pass( blk, false );
+			case node_type::local:       return operands[ 0 ]->pass( blk, false );
+			case node_type::zero:        operands[ 0 ]->pass( blk, xblock ); return 0;
+			case node_type::profile:
+			{
+				if ( auto profiler = pass_profiler::current() )
+					return profiler->measure( operands[ 0 ]->name(), blk, [ & ] () { return operands[ 0 ]->pass( blk, xblock ); } );
+
+				if ( !xblock )
+					logger::log( "Block %08x => %-64s |", blk->entry_vip, operands[ 0 ]->name() );
+
+				auto [cnt, time] = vtil::profile( [ & ] () { return operands[ 0 ]->pass( blk, xblock ); } );
+				if ( !xblock )
+					logger::log( " Took %-10s (N=%d).\n", time, cnt );
+				return cnt;
+			}
+			default:
+				unreachable();
+		}
+	}
+	size_t node::xpass( routine* rtn ) const
+	{
+		switch ( type )
+		{
+			case node_type::nop:         return 0;
+			case node_type::pass:        return entry->instances[ modifiers ].xpass( rtn );
+			case node_type::combine:     return xpass_range( *this, 0, rtn );
+			case node_type::conditional:
+			{
+				size_t n = operands[ 0 ]->xpass( rtn );
+				if ( n ) n += xpass_range( *this, 1, rtn );
+				return n;
+			}
+			case node_type::exhaust:     return impl::exhaust_routine( rtn, [ & ] ( routine* rtn ) { return xpass_range( *this, 0, rtn ); } );
+			case node_type::specialize:  return operands[ 1 ]->xpass( rtn );
+
+			// Modifiers on compound passes only change the block-level behaviour, the routine-level
+			// logic is inherited from the compound pass as is with local_pass<> and zero_pass<>.
+			//
+			case node_type::local:
+			case node_type::zero:        return operands[ 0 ]->xpass( rtn );
+			case node_type::profile:
+			{
+				if ( auto profiler = pass_profiler::current() )
+					return profiler->measure( operands[ 0 ]->name(), rtn, [ & ] () { return operands[ 0 ]->xpass( rtn ); } );
+
+				logger::log( "Routine => %-64s            |", operands[ 0 ]->name() );
+				auto [cnt, time] = vtil::profile( [ & ] () { return operands[ 0 ]->xpass( rtn ); } );
+				logger::log( " Took %-10s (N=%d).\n", time, cnt );
+				return cnt;
+			}
+			default:
+				unreachable();
+		}
+	}
+	std::string node::name() const
+	{
+		switch ( type )
+		{
+			case node_type::nop:         return "no-op";
+			case node_type::pass:        return entry->instances[ modifiers ].name();
+			case node_type::combine:     return name_range( *this, 0 );
+			case node_type::conditional: return "conditional{" + operands[ 0 ]->name() + " => " + name_range( *this, 1 ) + "}";
+			case node_type::exhaust:     return "exhaust{" + name_range( *this, 0 ) + "}";
+			case node_type::specialize:  return "specialize{local=" + operands[ 0 ]->name() + ", cross=" + operands[ 1 ]->name() + "}";
+			case node_type::local:       return "local{" + operands[ 0 ]->name() + "}";
+			case node_type::zero:        return "zero{" + operands[ 0 ]->name() + "}";
+			case node_type::profile:     return operands[ 0 ]->name();
+			default:
+				unreachable();
+		}
+	}
+
+	// Converts back into the description language.
+	//
+	std::string node::to_string() const
+	{
+		static constexpr const char* keywords[] = {
+			"nop", "", "combine", "conditional", "exhaust", "specialize", "local", "zero", "profile"
+		};
+
+		std::string result;
+		switch ( type )
+		{
+			case node_type::nop:
+				return "nop";
+			case node_type::pass:
+				result = entry->name;
+				if ( modifiers & pass_registry::modifier_local ) result = "local( " + result + " )";
+				if ( modifiers & pass_registry::modifier_zero )  result = "zero( " + result + " )";
+				return result;
+			default:
+				result = keywords[ ( size_t ) type ];
+				result += "( ";
+				for ( size_t i = 0; i != operands.size(); i++ )
+				{
+					if ( i ) result += ", ";
+					result += operands[ i ]->to_string();
+				}
+				return result + " )";
+		}
+	}
+	std::string pipeline::to_string() const
+	{
+		if ( root->type != node_type::combine )
+			return root->to_string();
+
+		std::string result;
+		for ( size_t i = 0; i != root->operands.size(); i++ )
+		{
+			if ( i ) result += ", ";
+			result += root->operands[ i ]->to_string();
+		}
+		return result;
+	}
+
+	// Creates a node of the given type.
+	//
+	static std::shared_ptr<node> make_node( node_type type, std::vector<node_ptr> operands = {} )
+	{
+		auto result = std::make_shared<node>();
+		result->type = type;
+		result->operands = std::move( operands );
+		return result;
+	}
+	static std::vector<node_ptr> roots_of( const std::vector<pipeline>& parts )
+	{
+		std::vector<node_ptr> result;
+		for ( auto& part : parts )
+		{
+			// Flatten nested combinations since they are associative.
+			//
+			if ( part.root->type == node_type::combine )
+				result.insert( result.end(), part.root->operands.begin(), part.root->operands.end() );
+			else
+				result.emplace_back( part.root );
+		}
+		return result;
+	}
+
+	// Builder interface, mirroring the template combinators.
+	//
+	pipeline pipeline::make( std::string_view name, const pass_registry& registry )
+	{
+		if ( auto entry = registry.find( name ) )
+		{
+			auto result = make_node( node_type::pass );
+			result->entry = entry;
+			return { std::move( result ) };
+		}
+		if ( auto description = registry.find_preset( name ) )
+			return parse( *description, registry );
+		throw std::runtime_error( format::str( "Unknown pass '%s'.", std::string{ name } ) );
+	}
+	pipeline pipeline::combine( const std::vector<pipeline>& parts )
+	{
+		auto operands = roots_of( parts );
+		if ( operands.empty() )
+			return {};
+		if ( operands.size() == 1 )
+			return { std::move( operands.front() ) };
+		return { make_node( node_type::combine, std::move( operands ) ) };
+	}
+	pipeline pipeline::conditional( const std::vector<pipeline>& parts )
+	{
+		if ( parts.size() < 2 )
+			throw std::runtime_error( "Conditional pass requires a condition and at least one pass." );
+
+		// Condition should not be flattened if it is a combination.
+		//
+		std::vector<node_ptr> operands = { parts.front().root };
+		auto rest = roots_of( { parts.begin() + 1, parts.end() } );
+		operands.insert( operands.end(), rest.begin(), rest.end() );
+		return { make_node( node_type::conditional, std::move( operands ) ) };
+	}
+	pipeline pipeline::exhaust( const std::vector<pipeline>& parts )
+	{
+		if ( parts.empty() )
+			throw std::runtime_error( "Exhaust pass requires at least one pass." );
+		return { make_node( node_type::exhaust, roots_of( parts ) ) };
+	}
+	pipeline pipeline::specialize( const pipeline& local, const pipeline& cross )
+	{
+		return { make_node( node_type::specialize, { local.root, cross.root } ) };
+	}
+	pipeline pipeline::local( const pipeline& part )
+	{
+		// Fold into the pass if applied on a registered one.
+		//
+		switch ( part.root->type )
+		{
+			case node_type::pass:
+			{
+				auto result = std::make_shared<node>( *part.root );
+				result->modifiers |= pass_registry::modifier_local;
+				return { std::move( result ) };
+			}
+			case node_type::local:
+				return part;
+			default:
+				return { make_node( node_type::local, { part.root } ) };
+		}
+	}
+	pipeline pipeline::zero( const pipeline& part )
+	{
+		// Fold into the pass if applied on a registered one.
+		//
+		switch ( part.root->type )
+		{
+			case node_type::pass:
+			{
+				auto result = std::make_shared<node>( *part.root );
+				result->modifiers |= pass_registry::modifier_zero;
+				return { std::move( result ) };
+			}
+			case node_type::zero:
+				return part;
+			default:
+				return { make_node( node_type::zero, { part.root } ) };
+		}
+	}
+	pipeline pipeline::profile( const pipeline& part )
+	{
+		if ( part.root->type == node_type::profile )
+			return part;
+		return { make_node( node_type::profile, { part.root } ) };
+	}
+
+	// Returns a copy with every individual pass profiled, equivalent of apply_each<profile_pass, ...>.
+	//
+	static node_ptr profile_each( const node_ptr& n )
+	{
+		switch ( n->type )
+		{
+			case node_type::combine:
+			case node_type::conditional:
+			case node_type::exhaust:
+			case node_type::specialize:
+			{
+				auto result = std::make_shared<node>( *n );
+				for ( auto& operand : result->operands )
+					operand = profile_each( operand );
+				return result;
+			}
+			case node_type::profile:
+				return n;
+			default:
+				return make_node( node_type::profile, { n } );
+		}
+	}
+	pipeline pipeline::profiled() const
+	{
+		return { profile_each( root ) };
+	}
+
+	// Parser for the description language.
+	//
+	struct pipeline_parser
+	{
+		std::string_view text;
+		const pass_registry& registry;
+
+		// Name of the preset being parsed if any and the presets being expanded at the moment,
+		// used to report errors and to catch recursive presets.
+		//
+		std::string source;
+		std::vector<std::string>& expanding;
+		size_t pos = 0;
+
+		// Throws an error describing the failure at the current position.
+		//
+		[[noreturn]] void parse_error( const char* reason, std::string_view token ) const
+		{
+			if ( source.empty() )
+				throw std::runtime_error( format::str( "Offset %llu: %s ('%s').", pos, reason, std::string{ token } ) );
+			else
+				throw std::runtime_error( format::str( "Preset '%s', offset %llu: %s ('%s').", std::string{ source }, pos, reason, std::string{ token } ) );
+		}
+
+		// Skips whitespace and comments.
+		//
+		void skip()
+		{
+			while ( pos < text.size() )
+			{
+				if ( isspace( ( uint8_t ) text[ pos ] ) )
+					pos++;
+				else if ( text[ pos ] == '#' )
+					while ( pos < text.size() && text[ pos ] != '\n' ) pos++;
+				else
+					break;
+			}
+		}
+
+		// Consumes the given character if it's next.
+		//
+		bool consume( char c )
+		{
+			skip();
+			if ( pos >= text.size() || text[ pos ] != c )
+				return false;
+			pos++;
+			return true;
+		}
+
+		// Reads a name, throws if there is none.
+		//
+		std::string_view next_name()
+		{
+			skip();
+			size_t begin = pos;
+			while ( pos < text.size() && ( isalnum( ( uint8_t ) text[ pos ] ) || text[ pos ] == '_' ) )
+				pos++;
+			if ( begin == pos )
+				parse_error( "Expected a pass", text.substr( pos, 16 ) );
+			return text.substr( begin, pos - begin );
+		}
+
+		// Parses a comma separated list of passes.
+		//
+		std::vector<pipeline> parse_sequence()
+		{
+			std::vector<pipeline> result;
+			do
+				result.emplace_back( parse_item() );
+			while ( consume( ',' ) );
+			return result;
+		}
+
+		// Parses a single pass or a combinator.
+		//
+		pipeline parse_item()
+		{
+			std::string_view name = next_name();
+
+			// If followed by an argument list, resolve the combinator.
+			//
+			if ( consume( '(' ) )
+			{
+				auto args = parse_sequence();
+				if ( !consume( ')' ) )
+					parse_error( "Expected ')'", text.substr( pos, 16 ) );
+
+				if ( name == "combine" )
+					return pipeline::combine( args );
+				if ( name == "exhaust" )
+					return pipeline::exhaust( args );
+				if ( name == "conditional" )
+				{
+					if ( args.size() < 2 )
+						parse_error( "Conditional pass requires at least two arguments", name );
+					return pipeline::conditional( args );
+				}
+				if ( name == "specialize" )
+				{
+					if ( args.size() != 2 )
+						parse_error( "Specialized pass requires exactly two arguments", name );
+					return pipeline::specialize( args[ 0 ], args[ 1 ] );
+				}
+				if ( name == "local" )
+					return pipeline::local( pipeline::combine( args ) );
+				if ( name == "zero" )
+					return pipeline::zero( pipeline::combine( args ) );
+				if ( name == "profile" )
+					return pipeline::profile( pipeline::combine( args ) );
+				parse_error( "Unknown combinator", name );
+			}
+
+			// Otherwise resolve the pass or the preset.
+			//
+			if ( name == "nop" )
+				return pipeline::nop();
+			if ( registry.find( name ) )
+				return pipeline::make( name, registry );
+			if ( auto description = registry.find_preset( name ) )
+			{
+				if ( std::find( expanding.begin(), expanding.end(), name ) != expanding.end() )
+					parse_error( "Recursive preset", name );
+
+				expanding.emplace_back( name );
+				pipeline_parser parser{ *description, registry, expanding.back(), expanding };
+				pipeline result = parser.parse();
+				expanding.pop_back();
+				return result;
+			}
+			parse_error( "Unknown pass", name );
+		}
+
+		// Parses the whole description.
+		//
+		pipeline parse()
+		{
+			auto result = pipeline::combine( parse_sequence() );
+			skip();
+			if ( pos != text.size() )
+				parse_error( "Unexpected character", text.substr( pos, 16 ) );
+			return result;
+		}
+	};
+
+	// Parses the description given, throws on failure.
+	//
+	pipeline pipeline::parse( std::string_view description, const pass_registry& registry )
+	{
+		std::vector<std::string> expanding;
+		return pipeline_parser{ description, registry, {}, expanding }.parse();
+	}
+
+	// Parses the preset with the given name, throws if it does not exist.
+	//
+	pipeline pipeline::preset( std::string_view name, const pass_registry& registry )
+	{
+		if ( !registry.find_preset( name ) )
+			throw std::runtime_error( format::str( "Unknown preset '%s'.", std::string{ name } ) );
+		return make( name, registry );
+	}
+};
@@ -0,0 +1,272 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include "interface.hpp"
+#include <array>
+#include <map>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <typeinfo>
+#include <vector>
+
+// Runtime composition of the optimization passes, the pipelines are described either
+// by a small text language or built programmatically, and follow the same semantics as
+// the template combinators declared in interface.hpp.
+//
+// Description language:
+//   sequence := item { ',' item }
+//   item     := name [ '(' sequence ')' ]
+//
+// Where name is either a registered pass, a preset or one of the combinators below:
+//   combine(a, b, ...)            => combine_pass<a, b, ...>
+//   exhaust(a, b, ...)            => exhaust_pass<a, b, ...>
+//   conditional(a, b, ...)        => conditional_pass<a, b, ...>
+//   specialize(local, cross)      => specialize_pass<local, cross>
+//   local(a), zero(a), profile(a) => local_pass<a>, zero_pass<a>, profile_pass<a>
+//   nop                           => nop_pass
+//
+// Whitespace is ignored and '#' starts a comment until the end of the line.
+//
+namespace vtil::optimizer
+{
+	// Registry of the passes and presets a pipeline can refer to by name.
+	//
+	struct pass_registry
+	{
+		// Modifiers that can be applied on a registered pass, as a bitmask.
+		//
+		enum modifier : uint8_t
+		{
+			modifier_none =  0,
+			modifier_local = 1 << 0,
+			modifier_zero =  1 << 1,
+			modifier_max =   1 << 2,
+		};
+
+		// Type erased pass, instantiated once per modifier combination. State is spawned
+		// for each call into pass and xpass like the template combinators do.
+		//
+		struct instance
+		{
+			size_t( *pass )( basic_block* blk, bool xblock );
+			size_t( *xpass )( routine* rtn );
+			std::string( *name )();
+		};
+		struct entry
+		{
+			std::string name;
+			std::array<instance, modifier_max> instances;
+			const std::type_info* type = nullptr;
+		};
+
+		// Registered passes and presets, entries are never removed so references
+		// to them stay valid for the lifetime of the registry.
+		//
+		mutable std::shared_mutex mtx;
+		std::map<std::string, entry, std::less<>> entries;
+		std::map<std::string, std::string, std::less<>> presets;
+
+		// Registers a pass under the given name, replacing any previous instantiation.
+		//
+		template<typename T>
+		void add( std::string name )
+		{
+			entry e = { name };
+			e.type = &typeid( T );
+			e.instances[ modifier_none ] =                  make_instance<T>();
+			e.instances[ modifier_local ] =                 make_instance<local_pass<T>>();
+			e.instances[ modifier_zero ] =                  make_instance<zero_pass<T>>();
+			e.instances[ modifier_local | modifier_zero ] = make_instance<zero_pass<local_pass<T>>>();
+
+			std::unique_lock _g{ mtx };
+			entries.insert_or_assign( std::move( name ), std::move( e ) );
+		}
+
+		// Registers a preset under the given name, which expands into the pipeline it describes.
+		//
+		void add_preset( std::string name, std::string description );
+
+		// Looks up a pass or a preset by name, returns null if not found.
+		//
+		const entry* find( std::string_view name ) const;
+		const entry* find( const std::type_info& type ) const;
+		std::optional<std::string> find_preset( std::string_view name ) const;
+
+		// Lists the names of the registered passes and presets.
+		//
+		std::vector<std::string> list() const;
+		std::vector<std::string> list_presets() const;
+
+		// Global registry, holding every built-in pass and preset.
+		//
+		static pass_registry& global();
+
+	private:
+		template<typename T>
+		static instance make_instance()
+		{
+			return {
+				[ ] ( basic_block* blk, bool xblock ) -> size_t { return T{}.pass( blk, xblock ); },
+				[ ] ( routine* rtn ) -> size_t { return T{}.xpass( rtn ); },
+				[ ] () -> std::string { return T{}.name(); }
+			};
+		}
+	};
+
+	// Pass composed at runtime, cheap to copy as the underlying tree is immutable and shared.
+	//
+	struct pipeline : pass_interface<execution_order::custom>
+	{
+		enum class node_type
+		{
+			nop,
+			pass,
+			combine,
+			conditional,
+			exhaust,
+			specialize,
+			local,
+			zero,
+			profile,
+		};
+
+		struct node
+		{
+			node_type type = node_type::nop;
+
+			// Registered pass and the modifiers applied on it if type is pass.
+			//
+			const pass_registry::entry* entry = nullptr;
+			uint8_t modifiers = pass_registry::modifier_none;
+
+			// Operands of the combinator otherwise.
+			//
+			std::vector<std::shared_ptr<const node>> operands;
+
+			// Implementation of the pass interface.
+			//
+			size_t pass( basic_block* blk, bool xblock ) const;
+			size_t xpass( routine* rtn ) const;
+			std::string name() const;
+
+			// Converts back into the description language.
+			//
+			std::string to_string() const;
+		};
+		std::shared_ptr<const node> root = std::make_shared<node>();
+
+		// Default constructs a no-op pipeline.
+		//
+		pipeline() = default;
+		pipeline( std::shared_ptr<const node> root ) : root( std::move( root ) ) {}
+
+		// Parses the description given, throws on failure.
+		//
+		static pipeline parse( std::string_view description, const pass_registry& registry = pass_registry::global() );
+
+		// Parses the preset with the given name, throws if it does not exist.
+		//
+		static pipeline preset( std::string_view name, const pass_registry& registry = pass_registry::global() );
+
+		// Builder interface, mirroring the template combinators.
+		//
+		static pipeline nop() { return {}; }
+		static pipeline make( std::string_view name, const pass_registry& registry = pass_registry::global() );
+		static pipeline combine( const std::vector<pipeline>& parts );
+		static pipeline conditional( const std::vector<pipeline>& parts );
+		static pipeline exhaust( const std::vector<pipeline>& parts );
+		static pipeline specialize( const pipeline& local, const pipeline& cross );
+		static pipeline local( const pipeline& part );
+		static pipeline zero( const pipeline& part );
+		static pipeline profile( const pipeline& part );
+
+		// Builds the pipeline equivalent to the given template pass, every individual pass in it
+		// should be registered, throws otherwise.
+		//
+		template<typename T>
+		static pipeline from( const pass_registry& registry = pass_registry::global() );
+
+		// Returns a copy with every individual pass profiled, equivalent of apply_each<profile_pass, ...>.
+		//
+		pipeline profiled() const;
+
+		// Implement the pass interface.
+		//
+		size_t pass( basic_block* blk, bool xblock = false ) override { return root->pass( blk, xblock ); }
+		size_t xpass( routine* rtn ) override { return root->xpass( rtn ); }
+		std::string name() override { return root->name(); }
+
+		// Converts back into the description language.
+		//
+		std::string to_string() const;
+	};
+
+	// Conversion of the template combinators into the pipeline builder calls.
+	//
+	namespace impl
+	{
+		template<typename T>
+		struct pipeline_of                                { static pipeline make( const pass_registry& r ); };
+		template<>
+		struct pipeline_of<nop_pass>                      { static pipeline make( const pass_registry& r ) { return pipeline::nop(); } };
+		template<typename... Tx>
+		struct pipeline_of<combine_pass<Tx...>>           { static pipeline make( const pass_registry& r ) { return pipeline::combine( { pipeline_of<Tx>::make( r )... } ); } };
+		template<typename... Tx>
+		struct pipeline_of<exhaust_pass<Tx...>>           { static pipeline make( const pass_registry& r ) { return pipeline::exhaust( { pipeline_of<Tx>::make( r )... } ); } };
+		template<typename... Tx>
+		struct pipeline_of<conditional_pass<Tx...>>       { static pipeline make( const pass_registry& r ) { return pipeline::conditional( { pipeline_of<Tx>::make( r )... } ); } };
+		template<typename T1, typename T2>
+		struct pipeline_of<specialize_pass<T1, T2>>       { static pipeline make( const pass_registry& r ) { return pipeline::specialize( pipeline_of<T1>::make( r ), pipeline_of<T2>::make( r ) ); } };
+		template<typename T>
+		struct pipeline_of<local_pass<T>>                 { static pipeline make( const pass_registry& r ) { return pipeline::local( pipeline_of<T>::make( r ) ); } };
+		template<typename T>
+		struct pipeline_of<zero_pass<T>>                  { static pipeline make( const pass_registry& r ) { return pipeline::zero( pipeline_of<T>::make( r ) ); } };
+		template<typename T>
+		struct pipeline_of<profile_pass<T>>               { static pipeline make( const pass_registry& r ) { return pipeline::profile( pipeline_of<T>::make( r ) ); } };
+
+		// Individual passes are looked up in the registry by their type.
+		//
+		template<typename T>
+		pipeline pipeline_of<T>::make( const pass_registry& r )
+		{
+			auto entry = r.find( typeid( T ) );
+			if ( !entry )
+				throw std::runtime_error( format::str( "Pass '%s' is not registered.", T{}.name() ) );
+			pipeline::node result;
+			result.type = pipeline::node_type::pass;
+			result.entry = entry;
+			return { std::make_shared<const pipeline::node>( std::move( result ) ) };
+		}
+	};
+	template<typename T>
+	pipeline pipeline::from( const pass_registry& registry ) { return impl::pipeline_of<T>::make( registry ); }
+};
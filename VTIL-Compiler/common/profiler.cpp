@@ -0,0 +1,196 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "profiler.hpp"
+#include <algorithm>
+
+namespace vtil::optimizer
+{
+	// Escapes a string for JSON.
+	//
+	static std::string quote_json( const std::string& str )
+	{
+		std::string out = "\"";
+		for ( char c : str )
+		{
+			if ( c == '"' || c == '\\' )
+				out += '\\';
+			if ( ( uint8_t ) c < 0x20 )
+				out += format::str( "\\u%04x", c );
+			else
+				out += c;
+		}
+		return out + "\"";
+	}
+
+	// Escapes a string for CSV.
+	//
+	static std::string quote_csv( const std::string& str )
+	{
+		std::string out = "\"";
+		for ( char c : str )
+		{
+			if ( c == '"' )
+				out += '"';
+			out += c;
+		}
+		return out + "\"";
+	}
+
+	// Summary of a record used by the exports.
+	//
+	struct record_summary
+	{
+		const pass_profiler::pass_record* record;
+		uint64_t mean_ns;
+		uint64_t p50_ns;
+		uint64_t p90_ns;
+		uint64_t p99_ns;
+		uint64_t max_ns;
+	};
+	static std::vector<record_summary> summarize( const std::map<std::pair<std::string, bool>, pass_profiler::pass_record>& records )
+	{
+		std::vector<record_summary> result;
+		for ( auto& [key, record] : records )
+		{
+			auto& durations = record.durations_ns;
+			result.push_back( {
+				.record = &record,
+				.mean_ns = record.calls ? record.total_ns / record.calls : 0,
+				.p50_ns = durations.percentile( 50 ),
+				.p90_ns = durations.percentile( 90 ),
+				.p99_ns = durations.percentile( 99 ),
+				.max_ns = durations.max
+			} );
+		}
+		std::sort( result.begin(), result.end(), [ ] ( auto& a, auto& b ) { return a.record->total_ns > b.record->total_ns; } );
+		return result;
+	}
+
+	// Records a call.
+	//
+	void pass_profiler::record( const std::string& name, bool routine_level, vip_t vip, timestamp_t t0, timestamp_t t1, size_t applied, 
+								size_t blocks_changed, int64_t instructions_removed, uint64_t simplifier_calls, uint64_t tracer_calls )
+	{
+		uint64_t duration = std::chrono::duration_cast<time::nanoseconds>( t1 - t0 ).count();
+
+		std::lock_guard _g( mtx );
+		auto& record = records[ { name, routine_level } ];
+		if ( !record.calls )
+		{
+			record.name = name;
+			record.routine_level = routine_level;
+		}
+		record.calls++;
+		record.total_ns += duration;
+		record.durations_ns.add( duration );
+		record.applied += applied;
+		record.blocks_changed += blocks_changed;
+		record.instructions_removed += instructions_removed;
+		record.simplifier_calls += simplifier_calls;
+		record.tracer_calls += tracer_calls;
+
+		if ( events.size() < max_events )
+		{
+			auto [it, _] = threads.emplace( std::this_thread::get_id(), ( uint32_t ) threads.size() );
+			events.push_back( {
+				.record = &record,
+				.thread = it->second,
+				.begin_ns = ( uint64_t ) std::max<int64_t>( std::chrono::duration_cast<time::nanoseconds>( t0 - origin ).count(), 0 ),
+				.duration_ns = duration,
+				.vip = vip
+			} );
+		}
+	}
+
+	// Resets all statistics.
+	//
+	void pass_profiler::reset()
+	{
+		std::lock_guard _g( mtx );
+		origin = time::now();
+		events.clear();
+		records.clear();
+		threads.clear();
+	}
+
+	// Exports the aggregated statistics as a JSON array or as CSV, ordered by total time.
+	//
+	std::string pass_profiler::to_json() const
+	{
+		std::lock_guard _g( mtx );
+
+		std::string out = "[";
+		for ( auto& summary : summarize( records ) )
+		{
+			auto* r = summary.record;
+			if ( out.size() != 1 ) out += ",";
+			out += format::str( 
+				"{\"name\":%s,\"level\":\"%s\",\"calls\":%llu,\"total_ns\":%llu,\"mean_ns\":%llu,\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"max_ns\":%llu,"
+				"\"applied\":%llu,\"blocks_changed\":%llu,\"instructions_removed\":%lld,\"simplifier_calls\":%llu,\"tracer_calls\":%llu}",
+				quote_json( r->name ), r->routine_level ? "routine" : "block", r->calls, r->total_ns, summary.mean_ns, summary.p50_ns, summary.p90_ns, summary.p99_ns, summary.max_ns,
+				r->applied, r->blocks_changed, r->instructions_removed, r->simplifier_calls, r->tracer_calls 
+			);
+		}
+		return out + "]";
+	}
+	std::string pass_profiler::to_csv() const
+	{
+		std::lock_guard _g( mtx );
+
+		std::string out = "name,level,calls,total_ns,mean_ns,p50_ns,p90_ns,p99_ns,max_ns,applied,blocks_changed,instructions_removed,simplifier_calls,tracer_calls\n";
+		for ( auto& summary : summarize( records ) )
+		{
+			auto* r = summary.record;
+			out += format::str( 
+				"%s,%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%lld,%llu,%llu\n",
+				quote_csv( r->name ), r->routine_level ? "routine" : "block", r->calls, r->total_ns, summary.mean_ns, summary.p50_ns, summary.p90_ns, summary.p99_ns, summary.max_ns,
+				r->applied, r->blocks_changed, r->instructions_removed, r->simplifier_calls, r->tracer_calls 
+			);
+		}
+		return out;
+	}
+
+	// Exports the recorded calls in the Chrome trace event format.
+	//
+	std::string pass_profiler::to_chrome_trace() const
+	{
+		std::lock_guard _g( mtx );
+
+		std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+		for ( size_t i = 0; i != events.size(); i++ )
+		{
+			auto& event = events[ i ];
+			out += format::str( 
+				"%s{\"name\":%s,\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3lf,\"dur\":%.3lf,\"pid\":0,\"tid\":%u,\"args\":{\"vip\":\"0x%llx\"}}",
+				i ? "," : "", quote_json( event.record->name ), event.record->routine_level ? "routine" : "block",
+				event.begin_ns / 1000.0, event.duration_ns / 1000.0, event.thread, event.vip
+			);
+		}
+		return out + "]}";
+	}
+};
@@ -0,0 +1,227 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vtil/arch>
+#include <vtil/symex>
+#include <array>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Aggregated profiling of the optimization passes, passes wrapped with profile_pass<> record
+// into the active profiler if there is one instead of logging every call.
+//
+namespace vtil::optimizer
+{
+	// Histogram of durations with a fixed number of buckets, each power of two is split into
+	// four buckets so that the reported percentiles are within 25% of the exact value.
+	//
+	struct duration_histogram
+	{
+		static constexpr size_t sub_buckets = 4;
+		std::array<uint64_t, 64 * sub_buckets> buckets = {};
+		uint64_t count = 0;
+		uint64_t max = 0;
+
+		// Maps a duration to its bucket and a bucket to the largest duration it holds.
+		//
+		static size_t bucket_of( uint64_t ns )
+		{
+			if ( ns < sub_buckets ) return ( size_t ) ns;
+			bitcnt_t shift = math::msb( ns ) - 3;
+			return ( shift + 1 ) * sub_buckets + ( ( ns >> shift ) & ( sub_buckets - 1 ) );
+		}
+		static uint64_t upper_bound_of( size_t index )
+		{
+			if ( index < sub_buckets ) return index;
+			size_t shift = index / sub_buckets - 1;
+			uint64_t base = ( sub_buckets + index % sub_buckets ) << shift;
+			return base + ( ( 1ull << shift ) - 1 );
+		}
+
+		// Adds a duration.
+		//
+		void add( uint64_t ns )
+		{
+			buckets[ bucket_of( ns ) ]++;
+			count++;
+			max = std::max( max, ns );
+		}
+
+		// Returns the p'th percentile, rounded up to the bucket bound.
+		//
+		uint64_t percentile( size_t p ) const
+		{
+			uint64_t rank = std::max<uint64_t>( ( count * p + 99 ) / 100, 1 );
+			for ( size_t i = 0; i != buckets.size(); i++ )
+				if ( ( rank = rank > buckets[ i ] ? rank - buckets[ i ] : 0 ) == 0 )
+					return std::min( upper_bound_of( i ), max );
+			return max;
+		}
+	};
+
+	struct pass_profiler
+	{
+		// Statistics of a single pass, block and routine level calls are recorded separately.
+		//
+		struct pass_record
+		{
+			std::string name;
+			bool routine_level = false;
+
+			// Number of calls, their total duration and their distribution.
+			//
+			uint64_t calls = 0;
+			uint64_t total_ns = 0;
+			duration_histogram durations_ns;
+
+			// Sum of the values returned by the pass, number of blocks whose epoch changed and
+			// the difference in instruction count.
+			//
+			uint64_t applied = 0;
+			uint64_t blocks_changed = 0;
+			int64_t instructions_removed = 0;
+
+			// Simplifier and tracer calls made from the thread invoking the pass during the call.
+			//
+			uint64_t simplifier_calls = 0;
+			uint64_t tracer_calls = 0;
+		};
+
+		// Single call, kept for the trace event export.
+		//
+		struct trace_event
+		{
+			const pass_record* record;
+			uint32_t thread;
+			uint64_t begin_ns;
+			uint64_t duration_ns;
+			vip_t vip;
+		};
+
+		// Maximum number of calls kept for the trace event export, further calls are only aggregated.
+		//
+		size_t max_events = 1 << 20;
+
+		// Recorded state, guarded by the mutex.
+		//
+		mutable std::mutex mtx;
+		timestamp_t origin = time::now();
+		std::map<std::pair<std::string, bool>, pass_record> records;
+		std::vector<trace_event> events;
+		std::unordered_map<std::thread::id, uint32_t> threads;
+
+		// Profiler the passes record into, null if none.
+		//
+		inline static std::atomic<pass_profiler*> active = nullptr;
+		static pass_profiler* current() { return active.load( std::memory_order_relaxed ); }
+
+		// RAII helper installing a profiler as the active one.
+		//
+		struct scope
+		{
+			pass_profiler* prev;
+			scope( pass_profiler& profiler ) : prev( active.exchange( &profiler ) ) {}
+			~scope() { active = prev; }
+		};
+
+		// Measures a block level call.
+		//
+		template<typename F>
+		size_t measure( const std::string& name, basic_block* blk, F&& fn )
+		{
+			epoch_t epoch = blk->epoch;
+			size_t instructions = blk->size();
+			uint64_t simplifier_calls = symbolic::simplifier_call_count();
+			uint64_t tracer_calls = tracer::thread_trace_calls;
+
+			timestamp_t t0 = time::now();
+			size_t n = fn();
+			timestamp_t t1 = time::now();
+
+			record( name, false, blk->entry_vip, t0, t1, n,
+					blk->epoch != epoch,
+					int64_t( instructions ) - int64_t( blk->size() ),
+					symbolic::simplifier_call_count() - simplifier_calls,
+					tracer::thread_trace_calls - tracer_calls );
+			return n;
+		}
+
+		// Measures a routine level call, tracer and simplifier calls made on the workers 
+		// are attributed to the block level records instead.
+		//
+		template<typename F>
+		size_t measure( const std::string& name, routine* rtn, F&& fn )
+		{
+			std::unordered_map<const basic_block*, epoch_t> epochs;
+			rtn->for_each( [ & ] ( const basic_block* blk ) { epochs.emplace( blk, blk->epoch ); } );
+			size_t instructions = rtn->num_instructions();
+			uint64_t simplifier_calls = symbolic::simplifier_call_count();
+			uint64_t tracer_calls = tracer::thread_trace_calls;
+
+			timestamp_t t0 = time::now();
+			size_t n = fn();
+			timestamp_t t1 = time::now();
+
+			size_t blocks_changed = 0;
+			rtn->for_each( [ & ] ( const basic_block* blk )
+			{
+				auto it = epochs.find( blk );
+				blocks_changed += it == epochs.end() || it->second != blk->epoch;
+			} );
+			record( name, true, rtn->entry_point ? rtn->entry_point->entry_vip : invalid_vip, t0, t1, n,
+					blocks_changed,
+					int64_t( instructions ) - int64_t( rtn->num_instructions() ),
+					symbolic::simplifier_call_count() - simplifier_calls,
+					tracer::thread_trace_calls - tracer_calls );
+			return n;
+		}
+
+		// Records a call.
+		//
+		void record( const std::string& name, bool routine_level, vip_t vip, timestamp_t t0, timestamp_t t1, size_t applied, 
+					 size_t blocks_changed, int64_t instructions_removed, uint64_t simplifier_calls, uint64_t tracer_calls );
+
+		// Resets all statistics.
+		//
+		void reset();
+
+		// Exports the aggregated statistics as a JSON array or as CSV, ordered by total time.
+		//
+		std::string to_json() const;
+		std::string to_csv() const;
+
+		// Exports the recorded calls in the Chrome trace event format.
+		//
+		std::string to_chrome_trace() const;
+	};
+};
@@ -48,10 +48,7 @@ namespace vtil::optimizer
 		//
 		cached_tracer local_tracer = {};
 		auto lbranch_info = aux::analyze_branch( blk, &local_tracer, {} );
-		ctracer.mtx.lock();
-		for ( auto& [k, v] : local_tracer.cache )
-			ctracer.cache[ k ] = v;
-		ctracer.mtx.unlock();
+		ctracer.merge( local_tracer );
 		auto branch_info = aux::analyze_branch( blk, &ctracer, { .cross_block = true, .pack = true, .resolve_opaque = true } );
 
 		// If branching to real, assert single next block.
@@ -126,24 +123,23 @@ namespace vtil::optimizer
 				{
 					// Iterate cache entries:
 					//
-					std::shared_lock _g{ tr->mtx };
-					for ( auto& [var, ex] : tr->cache )
+					tr->enumerate( [ & ] ( const symbolic::variable& var, const symbolic::expression::reference& ex )
 					{
 						// Skip if memory variable or has invalid iterator.
 						//
 						if ( var.is_memory() || !var.at.is_valid() )
-							continue;
+							return enumerator::ocontinue;
 
 						// If expressions are not identical skip.
 						//
 						if ( !ex->is_identical( *exp ) )
-							continue;
+							return enumerator::ocontinue;
 
 						// Set var_reg and break.
 						//
 						var_reg = var;
-						break;
-					}
+						return enumerator::obreak;
+					} );
 				}
 				else
 				{
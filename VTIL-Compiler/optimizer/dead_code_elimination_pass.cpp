@@ -44,11 +44,39 @@ namespace vtil::optimizer
 		//
 		cnd_shared_lock lock( mtx, xblock );
 
-		// Iterate backwards.
+		// Trace the pointers of every memory write at once.
 		//
+		std::vector<symbolic::variable> pointer_lookups;
+		std::vector<int64_t> pointer_offsets;
+		for ( auto it = blk->begin(); !it.is_end(); ++it )
+		{
+			if ( it->base->writes_memory() )
+			{
+				auto [base, offset] = it->memory_location();
+				pointer_lookups.emplace_back( it, base );
+				pointer_offsets.emplace_back( offset );
+			}
+		}
+		auto pointers = ctrace.trace_all( pointer_lookups );
+		size_t pointer_index = pointers.size();
+
+		// Iterate backwards while sweeping the register usage.
+		//
+		aux::usage_sweep sweep = { blk, xblock, &ctrace };
 		auto [rbegin, rend] = reverse_iterators( *blk );
-		for ( auto it = rbegin; it != rend; ++it )
+		for ( auto it = rbegin; it != rend; sweep.visit( it ), ++it )
 		{
+			// Pop the pointer if memory write.
+			//
+			symbolic::expression::reference pointer;
+			int64_t pointer_offset = 0;
+			if ( it->base->writes_memory() )
+			{
+				pointer_index--;
+				pointer = pointers[ pointer_index ];
+				pointer_offset = pointer_offsets[ pointer_index ];
+			}
+
 			// Skip if volatile or branching.
 			//
 			if ( it->base->is_branching() || it->is_volatile() )
@@ -71,7 +99,7 @@ namespace vtil::optimizer
 					// Create symbolic variable.
 					//
 					symbolic::variable var = { it, op.reg() };
-					if ( used = aux::is_used( var, xblock, &ctrace ) )
+					if ( used = sweep.is_used( var ) )
 						break;
 				}
 
@@ -79,8 +107,7 @@ namespace vtil::optimizer
 				//
 				if ( !used && it->base->writes_memory() )
 				{
-					auto [base, offset] = it->memory_location();
-					symbolic::pointer ptr = { ctrace.trace_p( { it, base } ) + offset };
+					symbolic::pointer ptr = { symbolic::variable::pack_all( pointer ) + pointer_offset };
 					if ( !( ptr.flags & register_stack_pointer ) )
 						used = true;
 					else
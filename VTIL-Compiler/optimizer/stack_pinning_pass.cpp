@@ -68,7 +68,7 @@ namespace vtil::optimizer
 
 					// Flush tracer cache.
 					//
-					ctrace.flush();
+					ctrace.flush( blk );
 
 					// Validate modification and increment counter.
 					//
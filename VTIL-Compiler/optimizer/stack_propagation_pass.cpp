@@ -87,6 +87,15 @@ namespace vtil::optimizer
 		std::vector<std::tuple<il_iterator, const instruction_desc*, operand>> ins_swap_buffer;
 		std::vector<std::tuple<il_iterator, const instruction_desc*, symbolic::variable>> ins_revive_swap_buffer;
 
+		// Trace the stack pointer at every stack read at once.
+		//
+		std::vector<symbolic::variable> sp_lookups;
+		for ( auto it = blk->begin(); !it.is_end(); it++ )
+			if ( !it->is_volatile() && it->base == &ins::ldd && it->memory_location().first.is_stack_pointer() )
+				sp_lookups.emplace_back( it, REG_SP );
+		auto sp_values = ctracer.trace_all( sp_lookups );
+		auto sp_value = sp_values.begin();
+
 		// For each instruction:
 		//
 		for ( auto it = blk->begin(); !it.is_end(); it++ )
@@ -106,7 +115,7 @@ namespace vtil::optimizer
 
 				// Lazy-trace the value.
 				//
-				symbolic::pointer ptr = { ctracer.trace( { it, REG_SP } ) + it->memory_location().second };
+				symbolic::pointer ptr = { *sp_value++ + it->memory_location().second };
 				symbolic::variable var = { it, { std::move( ptr ), it->access_size() } };
 				ltracer.bypass = it;
 				auto exp = xblock ? ltracer.rtrace( var ) : ltracer.trace( var );
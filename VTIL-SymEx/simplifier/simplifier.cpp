@@ -32,6 +32,8 @@
 #include "../directives/transformer.hpp"
 #include <vtil/io>
 #include <vtil/utility>
+#include <array>
+#include <shared_mutex>
 
 // [Configuration]
 // Determine the depth limit after which we start self generated signature matching and
@@ -976,10 +978,123 @@ namespace vtil::symbolic
 		return false;
 	}
 
+	// Simplification results shared between threads.
+	//
+	struct shared_simplifier_cache
+	{
+		struct entry
+		{
+			expression::reference key;
+			expression::reference result;
+			bool success;
+			bool pretty;
+			bool unpack;
+		};
+
+		// Entries are split into shards by their hash to reduce the contention of insertions.
+		//
+		struct shard
+		{
+			std::shared_mutex mtx;
+			std::unordered_multimap<size_t, entry> entries;
+		};
+		std::array<shard, 16> shards;
+
+		size_t capacity;
+		std::atomic<size_t> size = 0;
+		std::atomic<uint64_t> hits = 0;
+		std::atomic<uint64_t> misses = 0;
+
+		shared_simplifier_cache( size_t capacity ) : capacity( capacity ) {}
+
+		// Looks up the result of the simplification, returns the success flag if found.
+		//
+		std::optional<bool> lookup( expression::reference& exp, bool pretty, bool unpack )
+		{
+			size_t hash = exp->hash();
+			auto& shard = shards[ hash % shards.size() ];
+
+			std::shared_lock _g{ shard.mtx };
+			auto [it, end] = shard.entries.equal_range( hash );
+			for ( ; it != end; ++it )
+			{
+				auto& entry = it->second;
+				if ( entry.pretty == pretty && entry.unpack == unpack && entry.key.is_identical( *exp ) )
+				{
+					hits++;
+					exp = entry.result;
+					return entry.success;
+				}
+			}
+			misses++;
+			return std::nullopt;
+		}
+
+		// Inserts the result of a simplification.
+		//
+		void insert( expression::reference key, const expression::reference& result, bool success, bool pretty, bool unpack )
+		{
+			if ( size >= capacity )
+				return;
+
+			size_t hash = key->hash();
+			auto& shard = shards[ hash % shards.size() ];
+
+			std::unique_lock _g{ shard.mtx };
+			shard.entries.emplace( hash, entry{ std::move( key ), result, success, pretty, unpack } );
+			size++;
+		}
+	};
+	static thread_local shared_simplifier_cache_ptr shared_cache = nullptr;
+
+	shared_simplifier_cache_ptr make_shared_simplifier_cache( size_t capacity ) 
+	{ 
+		return std::make_shared<shared_simplifier_cache>( capacity ); 
+	}
+	shared_simplifier_cache_statistics get_statistics( const shared_simplifier_cache_ptr& cache )
+	{
+		if ( !cache ) return {};
+		return { cache->hits.load(), cache->misses.load(), cache->size.load() };
+	}
+	shared_simplifier_cache_ptr swap_shared_simplifier_cache( shared_simplifier_cache_ptr p )
+	{
+		std::swap( p, shared_cache );
+		return p;
+	}
+
 	// Simple routine wrapping real simplification to instrument it for any reason when needed.
 	//
+	static thread_local uint64_t call_count = 0;
+	static thread_local size_t call_depth = 0;
 	bool simplify_expression( expression::reference& exp, bool pretty, bool unpack )
 	{
-		return simplify_expression_i( exp, pretty, unpack );
+		struct scope_depth
+		{
+			size_t prev = call_depth++;
+			~scope_depth() { call_depth = prev; }
+		} _d;
+		call_count++;
+
+		// If there is no shared cache or if this is not the outermost request, simplify locally.
+		//
+		if ( !shared_cache || _d.prev || !exp->is_expression() || exp->simplify_hint || exp->value.is_known() )
+			return simplify_expression_i( exp, pretty, unpack );
+
+		// Consult the shared cache, if not found simplify locally and share the result.
+		//
+		if ( auto success = shared_cache->lookup( exp, pretty, unpack ) )
+			return *success;
+
+		expression::reference key = exp;
+		bool result = simplify_expression_i( exp, pretty, unpack );
+		shared_cache->insert( std::move( key ), exp, result, pretty, unpack );
+		return result;
+	}
+
+	// Number of simplification requests made by the current thread.
+	//
+	uint64_t simplifier_call_count()
+	{
+		return call_count;
 	}
 };
\ No newline at end of file
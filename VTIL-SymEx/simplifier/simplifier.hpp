@@ -59,6 +59,30 @@ namespace vtil::symbolic
 	//
 	bool simplify_expression( expression::reference& exp, bool pretty = false, bool unpack = true );
 
+	// Number of simplification requests made by the current thread, used to attribute
+	// the simplifier load to the callers.
+	//
+	uint64_t simplifier_call_count();
+
+	// Simplification results shared between threads, consulted by the outermost requests of the
+	// threads it is installed on before their own cache. It is read-mostly, entries are never
+	// evicted and insertion stops once the capacity is reached.
+	//
+	struct shared_simplifier_cache;
+	using shared_simplifier_cache_ptr = std::shared_ptr<shared_simplifier_cache>;
+	struct shared_simplifier_cache_statistics
+	{
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		size_t entries = 0;
+	};
+	shared_simplifier_cache_ptr make_shared_simplifier_cache( size_t capacity = 1 << 16 );
+	shared_simplifier_cache_statistics get_statistics( const shared_simplifier_cache_ptr& cache );
+
+	// Installs the shared cache given on the current thread, returns the previous one.
+	//
+	shared_simplifier_cache_ptr swap_shared_simplifier_cache( shared_simplifier_cache_ptr p = nullptr );
+
 	// Purges the current thread's simplifier cache.
 	//
 	void purge_simplifier_state();
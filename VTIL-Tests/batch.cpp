@@ -0,0 +1,80 @@
+#include "doctest.h"
+#include <vtil/vtil>
+#include "fixtures.hpp"
+#include <atomic>
+
+using namespace vtil;
+using namespace vtil::optimizer;
+
+// Serializes the routine into a buffer.
+//
+static std::string save( const routine* rtn )
+{
+	byte_writer out;
+	serialize( out, rtn );
+	return { ( const char* ) out.data(), out.size() };
+}
+
+DOCTEST_TEST_CASE("Batch ingestion")
+{
+	auto rtn = fixtures::make_loop();
+	std::string data = save( rtn.get() );
+	std::string corrupt = data;
+	corrupt.back() ^= 0x10;
+
+	std::vector<batch_source> sources;
+	for ( size_t n = 0; n != 8; n++ )
+	{
+		if ( n == 5 ) sources.emplace_back( corrupt.data(), corrupt.size() );
+		else          sources.emplace_back( data.data(), data.size() );
+	}
+
+	// Decode only, delivered in order with a single routine in flight.
+	//
+	std::vector<size_t> order;
+	batch_options options = {};
+	options.worker_count = 4;
+	options.max_in_flight = 1;
+	options.ordered = true;
+	options.optimize = false;
+	auto summary = ingest_batch( sources, [ & ] ( std::unique_ptr<routine> out, const batch_statistics& stats )
+	{
+		order.emplace_back( stats.index );
+		if ( stats.index == 5 )
+		{
+			CHECK( !out );
+			CHECK( !stats.error.empty() );
+		}
+		else
+		{
+			DOCTEST_REQUIRE( out );
+			CHECK( stats.error.empty() );
+			CHECK( stats.blocks_in == rtn->explored_blocks.size() );
+			CHECK( stats.instructions_out == stats.instructions_in );
+			CHECK( fixtures::listing( out.get() ) == fixtures::listing( rtn.get() ) );
+		}
+	}, options );
+	CHECK( summary.succeeded == 7 );
+	CHECK( summary.failed == 1 );
+	CHECK( summary.peak_in_flight == 1 );
+	CHECK( order == std::vector<size_t>{ 0, 1, 2, 3, 4, 5, 6, 7 } );
+
+	// Custom optimizer, unordered delivery.
+	//
+	std::atomic<size_t> calls = 0;
+	options = {};
+	options.optimizer = [ & ] ( routine* rtn ) { calls++; rtn->entry_point->insert( rtn->entry_point->begin(), { &ins::nop, {} } ); };
+	size_t delivered = 0;
+	summary = ingest_batch( sources, [ & ] ( std::unique_ptr<routine> out, const batch_statistics& stats )
+	{
+		delivered++;
+		if ( out )
+			CHECK( stats.instructions_out == stats.instructions_in + 1 );
+	}, options );
+	CHECK( delivered == sources.size() );
+	CHECK( calls == 7 );
+
+	// Exceptions thrown by the callback stop the batch and are rethrown.
+	//
+	CHECK_THROWS_AS( ingest_batch( sources, [ ] ( std::unique_ptr<routine>, const batch_statistics& ) { throw std::logic_error( "stop" ); } ), std::logic_error );
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <vtil/vtil>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Routines and helpers shared by the tests.
+//
+namespace fixtures
+{
+	using namespace vtil;
+
+	// Lists the instructions of the routine ordered by the block entry points.
+	//
+	inline std::string listing( const routine* rtn )
+	{
+		std::vector<vip_t> vips;
+		for ( auto& [vip, blk] : rtn->explored_blocks )
+			vips.emplace_back( vip );
+		std::sort( vips.begin(), vips.end() );
+
+		std::string result;
+		for ( vip_t vip : vips )
+		{
+			result += format::str( "%llx:\n", vip );
+			for ( auto& ins : *rtn->explored_blocks.at( vip ) )
+				result += ins.to_string() + "\n";
+		}
+		return result;
+	}
+
+	// Diamond shaped routine where the value computed at the entry is only used after the join.
+	//
+	inline std::unique_ptr<routine> make_diamond()
+	{
+		register_desc r0 = { register_virtual, 0, 64 };
+		register_desc r1 = { register_virtual, 1, 64 };
+		register_desc r2 = { register_virtual, 2, 64 };
+		register_desc cc = { register_virtual, 3, 1 };
+
+		auto* entry = basic_block::begin( 0x1000 );
+		entry->mov( r0, 1ull )->mov( r1, 2ull )->add( r0, r1 )->mov( r2, r0 )->js( cc, 0x2000ull, 0x3000ull );
+		auto* lhs = entry->fork( 0x2000 );
+		lhs->mov( r1, r0 )->add( r1, 5ull )->mov( r2, r1 )->jmp( 0x4000ull );
+		auto* rhs = entry->fork( 0x3000 );
+		rhs->mov( r1, r0 )->bxor( r1, r1 )->mov( r2, r1 )->jmp( 0x4000ull );
+		auto* exit = lhs->fork( 0x4000 );
+		rhs->fork( 0x4000 );
+		exit->mov( r0, r2 )->add( r0, r1 )->mov( r1, r0 )->vpinr( r0 )->vexit( 0ull );
+		return std::unique_ptr<routine>{ entry->owner };
+	}
+
+	// Routine with a loop spilling and reloading values through the stack.
+	//
+	inline std::unique_ptr<routine> make_loop()
+	{
+		register_desc r0 = { register_virtual, 0, 64 };
+		register_desc r1 = { register_virtual, 1, 64 };
+		register_desc r2 = { register_virtual, 2, 32 };
+		register_desc cc = { register_virtual, 3, 1 };
+
+		auto* entry = basic_block::begin( 0x1000 );
+		entry->mov( r0, REG_SP )->str( REG_SP, -8, r0 )->mov( r1, 0ull )->jmp( 0x2000ull );
+		auto* loop = entry->fork( 0x2000 );
+		loop
+			->ldd( r0, REG_SP, -8 )
+			->add( r1, r0 )
+			->mov( r2, r1 )
+			->bxor( r2, 0x55u )
+			->str( REG_SP, -16, r2 )
+			->tl( cc, r1, 0x100ull )
+			->js( cc, 0x2000ull, 0x3000ull );
+		loop->fork( 0x2000 );
+		auto* exit = loop->fork( 0x3000 );
+		exit->ldd( r2, REG_SP, -16 )->mov( r0, r2 )->vpinr( r0 )->vexit( 0ull );
+		return std::unique_ptr<routine>{ entry->owner };
+	}
+};
@@ -0,0 +1,104 @@
+#include "doctest.h"
+#include <vtil/vtil>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#if _WIN64
+	#include <io.h>
+	#define dup _dup
+	#define dup2 _dup2
+	#define fileno _fileno
+	#define close _close
+#else
+	#include <unistd.h>
+#endif
+
+using namespace vtil;
+
+// Routine covering registers of each kind, memory operands and each branch type.
+//
+static std::unique_ptr<routine> make_routine()
+{
+	register_desc r0 = { register_virtual, 0, 64 };
+	register_desc r1 = { register_virtual, 1, 32 };
+	register_desc cc = { register_virtual, 2, 1 };
+
+	auto* entry = basic_block::begin( 0x1000 );
+	entry
+		->mov( r0, REG_SP )
+		->ldd( r1, REG_SP, 8 )
+		->add( r1, 0x10u )
+		->str( REG_SP, -8, r1 )
+		->mov( x86_reg::X86_REG_EAX, r1 )
+		->te( cc, r1, 0u )
+		->js( cc, 0x2000ull, 0x3000ull );
+	auto* lhs = entry->fork( 0x2000 );
+	lhs->push( r0 )->vpinr( x86_reg::X86_REG_RAX )->jmp( 0x1000ull );
+	lhs->fork( 0x1000 );
+	auto* rhs = entry->fork( 0x3000 );
+	rhs->vexit( 0ull );
+	return std::unique_ptr<routine>{ entry->owner };
+}
+
+// Captures the output of debug::dump for the routine.
+//
+static std::string dump( const routine* rtn )
+{
+	auto path = std::filesystem::temp_directory_path() / "vtil_listing_test.txt";
+
+	// Redirect the standard output to the file while dumping.
+	//
+	fflush( stdout );
+	int prev = dup( fileno( stdout ) );
+	FILE* out = fopen( path.string().c_str(), "w" );
+	dup2( fileno( out ), fileno( stdout ) );
+	debug::dump( rtn );
+	fflush( stdout );
+	dup2( prev, fileno( stdout ) );
+	close( prev );
+	fclose( out );
+
+	std::stringstream ss;
+	ss << std::ifstream{ path }.rdbuf();
+	std::filesystem::remove( path );
+	return ss.str();
+}
+
+DOCTEST_TEST_CASE("Listing parser instructions")
+{
+	auto rtn = make_routine();
+	for ( auto& [vip, blk] : rtn->explored_blocks )
+	{
+		for ( auto& ins : *blk )
+		{
+			auto parsed = debug::parse_instruction( ins.to_string(), rtn->arch_id );
+			CHECK( parsed.to_string() == ins.to_string() );
+			CHECK( parsed.base == ins.base );
+			CHECK( parsed.access_size() == ins.access_size() );
+		}
+	}
+
+	CHECK( debug::parse_register( register_desc{ register_virtual, 3, 16, 8 }.to_string() ) == register_desc{ register_virtual, 3, 16, 8 } );
+	CHECK_THROWS( debug::parse_instruction( "movq t0" ) );
+}
+
+DOCTEST_TEST_CASE("Listing parser routines")
+{
+	auto rtn = make_routine();
+	std::unique_ptr<routine> parsed{ debug::parse_routine( dump( rtn.get() ), rtn->arch_id ) };
+
+	CHECK( parsed->explored_blocks.size() == rtn->explored_blocks.size() );
+	for ( auto& [vip, blk] : rtn->explored_blocks )
+	{
+		auto it = parsed->explored_blocks.find( vip );
+		DOCTEST_REQUIRE( it != parsed->explored_blocks.end() );
+		auto* pblk = it->second;
+
+		CHECK( pblk->size() == blk->size() );
+		CHECK( pblk->next.size() == blk->next.size() );
+		for ( auto i1 = blk->begin(), i2 = pblk->begin(); !i1.is_end() && !i2.is_end(); ++i1, ++i2 )
+			CHECK( i2->to_string() == i1->to_string() );
+	}
+}
@@ -0,0 +1,135 @@
+#include "doctest.h"
+#include <vtil/vtil>
+#include "fixtures.hpp"
+#include <map>
+
+using namespace vtil;
+using namespace vtil::optimizer;
+
+DOCTEST_TEST_CASE("Usage sweep")
+{
+	for ( auto& rtn : { fixtures::make_diamond(), fixtures::make_loop() } )
+	{
+		for ( bool rec : { false, true } )
+		{
+			cached_tracer ctrace = {};
+			for ( auto& [vip, blk] : rtn->explored_blocks )
+			{
+				// Every register written must resolve the same as the generic search.
+				//
+				aux::usage_sweep sweep = { blk, rec, &ctrace };
+				auto [rbegin, rend] = reverse_iterators( *blk );
+				for ( auto it = rbegin; it != rend; sweep.visit( it ), ++it )
+				{
+					for ( auto [op, type] : it->enum_operands() )
+					{
+						if ( type < operand_type::write || !op.is_register() )
+							continue;
+
+						symbolic::variable var = { it, op.reg() };
+						INFO( format::str( "Block %llx, %s", vip, it->to_string() ) );
+						CHECK( sweep.is_used( var ) == aux::is_used( var, rec, &ctrace ) );
+					}
+				}
+			}
+		}
+	}
+}
+
+// Checks the results of the liveness analysis against the tracer-based search and the given 
+// expectations for each register written, indexed by the block and the instruction index.
+//
+static void check_liveness( const routine* rtn, const std::map<std::pair<vip_t, size_t>, bool>& dead )
+{
+	auto liveness = aux::get_liveness( rtn );
+	auto fresh = aux::liveness_analysis::compute( rtn );
+
+	cached_tracer ctrace = {};
+	for ( auto& [vip, blk] : rtn->explored_blocks )
+	{
+		size_t idx = 0;
+		for ( auto it = blk->begin(); !it.is_end(); ++it, idx++ )
+		{
+			for ( auto [op, type] : it->enum_operands() )
+			{
+				if ( type < operand_type::write )
+					continue;
+
+				symbolic::variable var = { it, op.reg() };
+				bool expected = !dead.contains( { vip, idx } );
+				INFO( format::str( "Block %llx, instruction %llu", vip, idx ) );
+
+				auto result = liveness->is_used( var, true );
+				DOCTEST_REQUIRE( result.has_value() );
+				CHECK( *result == expected );
+				CHECK( fresh->is_used( var, true ) == result );
+				CHECK( aux::is_used( var, true, &ctrace ) == expected );
+
+				// Block-local queries must agree with the tracer wherever the analysis answers them.
+				//
+				if ( auto local = liveness->is_used( var, false ) )
+					CHECK( *local == aux::is_used( var, false, &ctrace ) );
+			}
+		}
+	}
+}
+
+DOCTEST_TEST_CASE("Liveness analysis")
+{
+	auto rtn = fixtures::make_diamond();
+
+	// The value moved into vr2 at the entry is overwritten by both branches and the last 
+	// move into vr1 is dead at the exit.
+	//
+	check_liveness( rtn.get(), { { { 0x1000, 3 }, false }, { { 0x4000, 2 }, false } } );
+
+	// Reading vr2 in one of the branches makes the value live again, the analysis should 
+	// only rebuild the summary of the modified block.
+	//
+	auto before = aux::get_liveness( rtn.get() );
+	auto* rhs = rtn->explored_blocks.at( 0x3000 );
+	rhs->insert( rhs->begin(), { &ins::vpinr, { register_desc{ register_virtual, 2, 64 } } } );
+	check_liveness( rtn.get(), { { { 0x4000, 2 }, false } } );
+
+	auto after = aux::get_liveness( rtn.get() );
+	CHECK( after != before );
+	CHECK( after->blocks.at( rtn->entry_point ) == before->blocks.at( rtn->entry_point ) );
+	CHECK( after->blocks.at( rhs ) != before->blocks.at( rhs ) );
+}
+
+DOCTEST_TEST_CASE("Liveness analysis freezing")
+{
+	register_desc r0 = { register_virtual, 0, 64 };
+	register_desc r2 = { register_virtual, 2, 64 };
+
+	auto rtn = fixtures::make_diamond();
+	auto* entry = rtn->entry_point;
+	auto* lhs = rtn->explored_blocks.at( 0x2000 );
+	auto* exit = rtn->explored_blocks.at( 0x4000 );
+	auto frozen = aux::get_liveness( rtn.get() );
+	{
+		auto _f = aux::freeze_liveness( rtn.get() );
+		exit->insert( exit->begin(), { &ins::nop, {} } );
+
+		// Snapshot is shared while frozen, queries into the modified block are not answered by it.
+		//
+		CHECK( aux::get_liveness( rtn.get() ) == frozen );
+		CHECK( !frozen->is_used( { exit->begin(), r0 }, true ).has_value() );
+
+		// Neither are the recursive queries in the blocks reaching a modified one, as what is live 
+		// at their end may have changed, here the value of vr2 written at the entry.
+		//
+		lhs->insert( lhs->begin(), { &ins::vpinr, { r2 } } );
+		symbolic::variable var = { std::next( entry->begin(), 3 ), r2 };
+		cached_tracer ctrace = {};
+		CHECK( !frozen->is_used( var, true ).has_value() );
+		CHECK( !frozen->is_used( { std::next( lhs->begin(), 3 ), r2 }, true ).has_value() );
+		CHECK( aux::is_used( var, true, &ctrace ) );
+
+		// Block-local queries in unmodified blocks are still answered.
+		//
+		CHECK( frozen->is_used( var, false ).has_value() );
+	}
+	CHECK( aux::get_liveness( rtn.get() ) != frozen );
+	check_liveness( rtn.get(), { { { 0x4000, 3 }, false } } );
+}
@@ -0,0 +1,293 @@
+#include "doctest.h"
+#include <vtil/vtil>
+#include "fixtures.hpp"
+#include <stdexcept>
+#include <mutex>
+
+using namespace vtil;
+using namespace vtil::optimizer;
+
+// Exhaust pass that reruns the combined pass over the whole routine until it converges.
+//
+template<typename... Tx>
+struct naive_exhaust_pass : pass_interface<>
+{
+	size_t pass( basic_block* blk, bool xblock = false ) override
+	{
+		size_t n = 0;
+		while ( size_t m = combine_pass<Tx...>{}.pass( blk, xblock ) )
+			n += m;
+		return n;
+	}
+	size_t xpass( routine* rtn ) override
+	{
+		size_t n = 0;
+		while ( size_t m = combine_pass<Tx...>{}.xpass( rtn ) )
+			n += m;
+		return n;
+	}
+};
+
+// Pass that always fails.
+//
+struct throwing_pass : pass_interface<execution_order::serial>
+{
+	size_t pass( basic_block* blk, bool xblock = false ) override
+	{
+		throw std::runtime_error( "pass failed" );
+	}
+};
+
+// Lists the instructions of a single block.
+//
+static std::string listing( const basic_block* blk )
+{
+	std::string result;
+	for ( auto& ins : *blk )
+		result += ins.to_string() + "\n";
+	return result;
+}
+
+DOCTEST_TEST_CASE("Exhaust pass equivalence")
+{
+	auto check = [ ] ( std::unique_ptr<routine> rtn )
+	{
+		std::unique_ptr<routine> baseline{ rtn->clone() };
+		exhaust_pass<collective_propagation_pass, local_pass<dead_code_elimination_pass>>{}( rtn.get() );
+		naive_exhaust_pass<collective_propagation_pass, local_pass<dead_code_elimination_pass>>{}( baseline.get() );
+		CHECK( fixtures::listing( rtn.get() ) == fixtures::listing( baseline.get() ) );
+	};
+	check( fixtures::make_diamond() );
+	check( fixtures::make_loop() );
+}
+
+DOCTEST_TEST_CASE("Exhaust pass filtering")
+{
+	auto rtn = fixtures::make_diamond();
+	auto* exit = rtn->explored_blocks.at( 0x4000 );
+	std::string before = listing( exit );
+
+	// The worklist never leaves the enclosing filter and the filter is restored.
+	//
+	path_set only = { rtn->entry_point };
+	auto& filter = rtn->context.get<optimizer::impl::block_filter>();
+	filter.blocks = &only;
+	exhaust_pass<local_pass<mov_propagation_pass>, local_pass<dead_code_elimination_pass>>{}( rtn.get() );
+	CHECK( filter.blocks == &only );
+	CHECK( listing( exit ) == before );
+
+	// Restored even if a pass throws.
+	//
+	CHECK_THROWS( exhaust_pass<throwing_pass>{}( rtn.get() ) );
+	CHECK( filter.blocks == &only );
+	filter.blocks = nullptr;
+}
+
+DOCTEST_TEST_CASE("Pass pipelines")
+{
+	// The default preset is the same composition as apply_all.
+	//
+	CHECK( pass_registry::global().find_preset( "default" ) == pipeline::from<collective_pass>().to_string() );
+	for ( auto& rtn : { fixtures::make_diamond(), fixtures::make_loop() } )
+	{
+		std::unique_ptr<routine> copy{ rtn->clone() };
+		apply_all( rtn.get() );
+		pipeline::preset( "default" )( copy.get() );
+		CHECK( fixtures::listing( rtn.get() ) == fixtures::listing( copy.get() ) );
+	}
+
+	// Descriptions match the template combinators and round-trip through the parser.
+	//
+	auto p = pipeline::parse( "exhaust( mov_propagation, # comment\n local( dead_code_elimination ) )" );
+	CHECK( p.to_string() == pipeline::from<exhaust_pass<mov_propagation_pass, local_pass<dead_code_elimination_pass>>>().to_string() );
+	CHECK( pipeline::parse( p.to_string() ).to_string() == p.to_string() );
+
+	// Malformed descriptions are rejected.
+	//
+	CHECK_THROWS( pipeline::parse( "unknown_pass" ) );
+	CHECK_THROWS( pipeline::parse( "exhaust( mov_propagation" ) );
+	CHECK_THROWS( pipeline::parse( "conditional( mov_propagation )" ) );
+	CHECK_THROWS( pipeline::preset( "unknown_preset" ) );
+}
+
+DOCTEST_TEST_CASE("Parallel block scheduling")
+{
+	// Binary tree of blocks joining back into a single exit.
+	//
+	register_desc cc = { register_virtual, 3, 1 };
+	auto* entry = basic_block::begin( 0x1000 );
+	std::vector<basic_block*> level = { entry };
+	for ( int depth = 0; depth != 4; depth++ )
+	{
+		std::vector<basic_block*> next;
+		for ( auto* blk : level )
+		{
+			vip_t lhs = blk->entry_vip * 2, rhs = blk->entry_vip * 2 + 1;
+			blk->js( cc, lhs, rhs );
+			next.emplace_back( blk->fork( lhs ) );
+			next.emplace_back( blk->fork( rhs ) );
+		}
+		level = std::move( next );
+	}
+	for ( auto* blk : level )
+		blk->jmp( 0x100000ull );
+	auto* exit = level.front()->fork( 0x100000 );
+	for ( auto* blk : level )
+		blk->fork( 0x100000 );
+	exit->vexit( 0ull );
+	std::unique_ptr<routine> rtn{ entry->owner };
+
+	// Every block runs once and only after the blocks it depends on.
+	//
+	for ( bool fwd : { true, false } )
+	{
+		auto entries = rtn->get_depth_ordered_list( fwd );
+		std::unordered_map<const basic_block*, size_t> positions;
+		for ( size_t i = 0; i != entries.size(); i++ )
+			positions.emplace( entries[ i ].block, i );
+
+		std::mutex mtx;
+		std::unordered_map<const basic_block*, size_t> done;
+		bool ordered = true;
+		optimizer::impl::schedule_parallel( entries, fwd, [ & ] ( basic_block* blk )
+		{
+			std::lock_guard _g{ mtx };
+			for ( auto* dep : ( fwd ? blk->prev : blk->next ) )
+				if ( positions.at( dep ) < positions.at( blk ) )
+					ordered &= done.contains( dep );
+			done[ blk ]++;
+		} );
+		CHECK( ordered );
+		CHECK( done.size() == rtn->num_blocks() );
+		for ( auto& [blk, n] : done )
+			CHECK( n == 1 );
+	}
+
+	// Exceptions thrown by the worker are propagated.
+	//
+	CHECK_THROWS( optimizer::impl::schedule_parallel( rtn->get_depth_ordered_list( true ), true, [ ] ( basic_block* blk )
+	{
+		if ( !blk->next.size() )
+			throw std::runtime_error( "failed" );
+	} ) );
+}
+
+DOCTEST_TEST_CASE("Pass profiler")
+{
+	// Percentiles are within a bucket of the exact value and never above the maximum.
+	//
+	duration_histogram histogram = {};
+	for ( uint64_t ns = 1; ns <= 1000; ns++ )
+		histogram.add( ns );
+	CHECK( histogram.count == 1000 );
+	CHECK( histogram.max == 1000 );
+	CHECK( histogram.percentile( 50 ) >= 500 );
+	CHECK( histogram.percentile( 50 ) <= 500 * 5 / 4 );
+	CHECK( histogram.percentile( 90 ) >= 900 );
+	CHECK( histogram.percentile( 99 ) <= 1000 );
+	CHECK( duration_histogram{}.percentile( 50 ) == 0 );
+	for ( uint64_t ns : { 0ull, 3ull, 4ull, 1000ull, ~0ull } )
+		CHECK( duration_histogram::upper_bound_of( duration_histogram::bucket_of( ns ) ) >= ns );
+
+	// Profiled passes record into the active profiler only.
+	//
+	pass_profiler profiler = {};
+	auto rtn = fixtures::make_diamond();
+	{
+		pass_profiler::scope _s{ profiler };
+		profile_pass<mov_propagation_pass>{}( rtn.get() );
+	}
+	profile_pass<mov_propagation_pass>{}( rtn.get() );
+
+	auto name = mov_propagation_pass{}.name();
+	auto& block_record = profiler.records.at( { name, false } );
+	auto& routine_record = profiler.records.at( { name, true } );
+	CHECK( block_record.calls == rtn->num_blocks() );
+	CHECK( block_record.durations_ns.count == block_record.calls );
+	CHECK( routine_record.calls == 1 );
+	CHECK( profiler.events.size() == block_record.calls + routine_record.calls );
+
+	CHECK( profiler.to_json().find( "\"calls\":1," ) != std::string::npos );
+	auto csv = profiler.to_csv();
+	CHECK( std::count( csv.begin(), csv.end(), '\n' ) == 3 );
+	CHECK( profiler.to_chrome_trace().starts_with( "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[{" ) );
+
+	profiler.reset();
+	CHECK( profiler.records.empty() );
+	CHECK( profiler.events.empty() );
+}
+
+DOCTEST_TEST_CASE("Time-boxed optimization")
+{
+	using passes = combine_pass<local_pass<mov_propagation_pass>, exhaust_pass<local_pass<dead_code_elimination_pass>>>;
+
+	// An expired deadline skips every pass and leaves the routine untouched.
+	//
+	auto rtn = fixtures::make_diamond();
+	std::string before = fixtures::listing( rtn.get() );
+	auto result = apply_timeboxed( rtn.get(), passes{}, time::unit_t{ 0 } );
+	CHECK( result.expired );
+	CHECK( result.applied == 0 );
+	CHECK( result.skipped_blocks + result.skipped_passes.size() != 0 );
+	CHECK( fixtures::listing( rtn.get() ) == before );
+	CHECK( rtn->context.get<optimizer::impl::pass_deadline>().deadline == timestamp_t::max() );
+
+	// A generous deadline matches the untimed passes.
+	//
+	std::unique_ptr<routine> baseline{ rtn->clone() };
+	result = apply_timeboxed( rtn.get(), passes{}, std::chrono::hours( 1 ) );
+	size_t applied = passes{}( baseline.get() );
+	CHECK( !result.expired );
+	CHECK( result.applied == applied );
+	CHECK( result.skipped_passes.empty() );
+	CHECK( result.skipped_blocks == 0 );
+	CHECK( result.interrupted_loops == 0 );
+	CHECK( fixtures::listing( rtn.get() ) == fixtures::listing( baseline.get() ) );
+
+	// The deadline is disarmed even if a pass throws.
+	//
+	CHECK_THROWS( apply_timeboxed( rtn.get(), throwing_pass{}, std::chrono::hours( 1 ) ) );
+	CHECK( rtn->context.get<optimizer::impl::pass_deadline>().deadline == timestamp_t::max() );
+}
+
+DOCTEST_TEST_CASE("Multi-routine optimization")
+{
+	// Concurrent optimization matches optimizing each routine on its own.
+	//
+	std::vector<std::unique_ptr<routine>> routines, baselines;
+	for ( int n = 0; n != 4; n++ )
+	{
+		routines.emplace_back( n & 1 ? fixtures::make_loop() : fixtures::make_diamond() );
+		baselines.emplace_back( routines.back()->clone() );
+	}
+	std::vector<routine*> list;
+	for ( auto& rtn : routines )
+		list.emplace_back( rtn.get() );
+
+	multi_routine_options options = {};
+	options.worker_count = 3;
+	options.passes = pipeline::parse( "exhaust( mov_propagation, local( dead_code_elimination ) ), register_renaming" );
+	auto summary = optimize_routines( list, options );
+	CHECK( summary.succeeded == routines.size() );
+	CHECK( summary.failures.empty() );
+	CHECK( summary.jobs == routines.size() * 2 );
+
+	size_t applied = 0;
+	for ( size_t i = 0; i != routines.size(); i++ )
+	{
+		applied += options.passes->xpass( baselines[ i ].get() );
+		CHECK( fixtures::listing( routines[ i ].get() ) == fixtures::listing( baselines[ i ].get() ) );
+	}
+	CHECK( summary.applied == applied );
+
+	// Failures are reported per routine without stopping the others.
+	//
+	pass_registry registry;
+	registry.add<throwing_pass>( "throwing" );
+	options.passes = pipeline::parse( "throwing", registry );
+	summary = optimize_routines( list, options );
+	CHECK( summary.succeeded == 0 );
+	CHECK( summary.failures.size() == routines.size() );
+	for ( auto& [index, reason] : summary.failures )
+		CHECK( reason == "pass failed" );
+}
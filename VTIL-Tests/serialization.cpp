@@ -0,0 +1,179 @@
+#include "doctest.h"
+#include <vtil/vtil>
+#include "../VTIL-Compiler/validation/test1.hpp"
+#include "fixtures.hpp"
+#include <filesystem>
+#include <sstream>
+
+using namespace vtil;
+using fixtures::listing;
+
+// Serializes the routine into a buffer.
+//
+static std::string save( const routine* rtn )
+{
+	byte_writer out;
+	serialize( out, rtn );
+	return { ( const char* ) out.data(), out.size() };
+}
+
+// Deserializes the routine from a buffer.
+//
+static std::unique_ptr<routine> load( const std::string& data )
+{
+	routine* rtn;
+	byte_reader in{ data.data(), data.size() };
+	deserialize( in, rtn );
+	return std::unique_ptr<routine>{ rtn };
+}
+
+// Probes the routine in a buffer.
+//
+static routine_summary probe( const std::string& data, bool verify_checksums = true )
+{
+	byte_reader in{ data.data(), data.size() };
+	return vtil::probe( in, verify_checksums );
+}
+
+DOCTEST_TEST_CASE("CRC32-C")
+{
+	CHECK( crc32c( "123456789", 9 ) == 0xE3069283 );
+	CHECK( crc32c( "56789", 5, crc32c( "1234", 4 ) ) == 0xE3069283 );
+	CHECK( impl::crc32c_sw( ~0u, ( const uint8_t* ) "123456789", 9 ) == ~0xE3069283u );
+}
+
+DOCTEST_TEST_CASE("Serialization round-trip")
+{
+	// Unversioned files are still readable, the sample routines are stored in that format.
+	//
+	auto rtn0 = optimizer::validation::test1{}.generate();
+	CHECK( !rtn0->explored_blocks.empty() );
+	CHECK( listing( load( save( rtn0.get() ) ).get() ) == listing( rtn0.get() ) );
+
+	auto rtn = fixtures::make_loop();
+	auto copy = load( save( rtn.get() ) );
+	CHECK( listing( copy.get() ) == listing( rtn.get() ) );
+	CHECK( copy->entry_point->entry_vip == rtn->entry_point->entry_vip );
+	CHECK( copy->explored_blocks.at( 0x2000 )->prev.size() == 2 );
+
+	// Stream wrappers produce and consume the same bytes as the buffers.
+	//
+	std::stringstream ss;
+	serialize( ss, rtn.get() );
+	CHECK( ss.str() == save( rtn.get() ) );
+	routine* streamed;
+	deserialize( ss, streamed );
+	CHECK( listing( std::unique_ptr<routine>{ streamed }.get() ) == listing( rtn.get() ) );
+}
+
+DOCTEST_TEST_CASE("Serialization probe")
+{
+	auto rtn = fixtures::make_loop();
+	auto data = save( rtn.get() );
+
+	auto summary = probe( data );
+	CHECK( summary.is_valid() );
+	CHECK( summary.version == format_version );
+	CHECK( summary.arch_id == rtn->arch_id );
+	CHECK( summary.block_count == rtn->explored_blocks.size() );
+	CHECK( summary.instruction_count == rtn->num_instructions() );
+	CHECK( summary.byte_count == data.size() );
+
+	// Truncated files are rejected.
+	//
+	CHECK( !probe( data.substr( 0, data.size() - 1 ) ).is_valid() );
+	CHECK( !probe( data.substr( 0, 12 ) ).is_valid() );
+}
+
+DOCTEST_TEST_CASE("Serialization corruption")
+{
+	auto rtn = fixtures::make_loop();
+	auto data = save( rtn.get() );
+
+	// Flipping a bit in the payload fails the chunk checksum.
+	//
+	auto payload = data;
+	payload.back() ^= 0x10;
+	CHECK_THROWS_WITH_AS( load( payload ), "Chunk checksum mismatch.", std::runtime_error );
+	CHECK( !probe( payload ).is_valid() );
+	CHECK( probe( payload, false ).is_valid() );
+
+	// Flipping a bit in the extended header fails the header checksum.
+	//
+	auto header = data;
+	header[ 8 + 4 ] ^= 0x1;
+	CHECK_THROWS_WITH_AS( load( header ), "Header checksum mismatch.", std::runtime_error );
+	CHECK( !probe( header ).is_valid() );
+
+	// A block count that could not fit in the file is rejected before allocating, even if 
+	// the header checksum is consistent, both from memory and from streams.
+	//
+	auto count = data;
+	uint32_t block_count = 0xFFFFFFFF;
+	memcpy( &count[ 8 + 4 ], &block_count, sizeof( block_count ) );
+	uint32_t checksum = crc32c( &count[ 8 ], 16 );
+	memcpy( &count[ 8 + 16 ], &checksum, sizeof( checksum ) );
+	CHECK_THROWS_WITH_AS( load( count ), "Invalid block count.", std::runtime_error );
+	CHECK( !probe( count ).is_valid() );
+
+	routine* streamed = nullptr;
+	std::stringstream ss{ count };
+	CHECK_THROWS_WITH_AS( deserialize( ss, streamed ), "Invalid block count.", std::runtime_error );
+	CHECK( !streamed );
+}
+
+DOCTEST_TEST_CASE("Serialization files")
+{
+	auto rtn = fixtures::make_loop();
+	auto path = std::filesystem::temp_directory_path() / "vtil_serialization_test.vtil";
+
+	save_routine( rtn.get(), path );
+	CHECK( std::filesystem::file_size( path ) == save( rtn.get() ).size() );
+	CHECK( listing( std::unique_ptr<routine>{ load_routine( path ) }.get() ) == listing( rtn.get() ) );
+	CHECK( probe_routine( path ).block_count == rtn->explored_blocks.size() );
+	std::filesystem::remove( path );
+}
+
+DOCTEST_TEST_CASE("Serialization incremental")
+{
+	auto rtn = fixtures::make_loop();
+	auto path = std::filesystem::temp_directory_path() / "vtil_incremental_test.vtil";
+
+	// First save writes every block.
+	//
+	auto result = save_routine_incremental( rtn.get(), path );
+	CHECK( !result.appended );
+	CHECK( result.blocks_written == rtn->explored_blocks.size() );
+	std::unique_ptr<routine> copy{ load_routine( path ) };
+	CHECK( listing( copy.get() ) == listing( rtn.get() ) );
+
+	// Saving the loaded routine after modifying a block appends only that block.
+	//
+	auto* blk = copy->explored_blocks.at( 0x2000 );
+	blk->insert( blk->begin(), { &ins::nop, {} } );
+	result = save_routine_incremental( copy.get(), path );
+	CHECK( result.appended );
+	CHECK( result.blocks_written == 1 );
+	CHECK( result.blocks_reused == copy->explored_blocks.size() - 1 );
+	CHECK( listing( std::unique_ptr<routine>{ load_routine( path ) }.get() ) == listing( copy.get() ) );
+
+	// Saving again without changes writes no blocks.
+	//
+	result = save_routine_incremental( copy.get(), path );
+	CHECK( result.blocks_written == 0 );
+
+	auto summary = probe_routine( path );
+	CHECK( summary.is_valid() );
+	CHECK( summary.version == format_version_appendable );
+	CHECK( summary.block_count == copy->explored_blocks.size() );
+	CHECK( summary.instruction_count == copy->num_instructions() );
+
+	// Saving to another path rewrites the file.
+	//
+	auto other = std::filesystem::temp_directory_path() / "vtil_incremental_test_2.vtil";
+	result = save_routine_incremental( copy.get(), other );
+	CHECK( !result.appended );
+	CHECK( result.blocks_written == copy->explored_blocks.size() );
+	std::filesystem::remove( path );
+	std::filesystem::remove( other );
+}
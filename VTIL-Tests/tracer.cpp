@@ -0,0 +1,440 @@
+#include "doctest.h"
+#include <vtil/vtil>
+#include "fixtures.hpp"
+#include <thread>
+
+using namespace vtil;
+
+// Registers read by the tests, matching the ones written by fixtures::make_loop.
+//
+static const register_desc r0 = { register_virtual, 0, 64 };
+static const register_desc r1 = { register_virtual, 1, 64 };
+static const register_desc r2 = { register_virtual, 2, 32 };
+
+// Lists every variable read at the end of each block of the routine.
+//
+static std::vector<symbolic::variable> variables_of( const routine* rtn )
+{
+	std::vector<symbolic::variable> result;
+	for ( auto& [vip, blk] : rtn->explored_blocks )
+	{
+		auto sp = symbolic::variable{ blk->begin(), REG_SP }.to_expression();
+		for ( auto& reg : { r0, r1, r2, REG_SP } )
+			result.emplace_back( blk->end(), reg );
+		result.emplace_back( blk->end(), symbolic::variable::memory_t{ symbolic::pointer{ sp - 8 }, 64 } );
+		result.emplace_back( blk->end(), symbolic::variable::memory_t{ symbolic::pointer{ sp - 16 }, 32 } );
+	}
+	return result;
+}
+
+// Compares two trace results, either of which may be null.
+//
+static bool same( const symbolic::expression::reference& a, const symbolic::expression::reference& b )
+{
+	if ( !a || !b ) return !a && !b;
+	return a->equals( *b );
+}
+
+DOCTEST_TEST_CASE("Cached tracer")
+{
+	auto rtn = fixtures::make_loop();
+	auto vars = variables_of( rtn.get() );
+
+	// Cached results must match the primitive tracer, both on the miss and on the hit.
+	//
+	tracer ptracer = {};
+	cached_tracer ctracer = {};
+	for ( int pass = 0; pass != 2; pass++ )
+		for ( auto& var : vars )
+			CHECK( ctracer.trace( var )->equals( *ptracer.trace( var ) ) );
+	size_t entries = ctracer.size();
+	CHECK( entries >= vars.size() );
+
+	// Partial matches are served from the larger entry.
+	//
+	auto* exit = rtn->explored_blocks.at( 0x3000 );
+	symbolic::variable low = { exit->end(), r0.select( 16, 0 ) };
+	CHECK( ctracer.trace( low )->equals( *ptracer.trace( low ) ) );
+	CHECK( ctracer.size() == entries + 1 );
+
+	// Merging copies every entry, merging into itself is a no-op.
+	//
+	cached_tracer other = {};
+	other.merge( ctracer );
+	CHECK( other.size() == ctracer.size() );
+	other.merge( other );
+	CHECK( other.size() == ctracer.size() );
+	size_t enumerated = 0;
+	other.enumerate( [ & ] ( const symbolic::variable& var, const symbolic::expression::reference& exp )
+	{
+		enumerated++;
+		CHECK( exp->equals( *ptracer.trace( var ) ) );
+	} );
+	CHECK( enumerated == other.size() );
+
+	// Flushing a block only drops the entries at that block.
+	//
+	size_t at_exit = 0;
+	ctracer.enumerate( [ & ] ( const symbolic::variable& var, auto& ) { at_exit += var.at.block == exit; } );
+	CHECK( at_exit != 0 );
+	ctracer.flush( exit );
+	CHECK( ctracer.size() == other.size() - at_exit );
+	ctracer.flush();
+	CHECK( ctracer.size() == 0 );
+}
+
+DOCTEST_TEST_CASE("Cached tracer concurrency")
+{
+	auto rtn = fixtures::make_loop();
+	auto vars = variables_of( rtn.get() );
+
+	tracer ptracer = {};
+	std::vector<symbolic::expression::reference> expected;
+	for ( auto& var : vars )
+		expected.emplace_back( ptracer.rtrace( var ) );
+
+	// Threads racing on the same variables must all observe the traced result.
+	//
+	cached_tracer ctracer = {};
+	std::vector<std::thread> threads;
+	std::vector<std::vector<symbolic::expression::reference>> results( 8 );
+	for ( auto& out : results )
+	{
+		threads.emplace_back( [ & ]
+		{
+			for ( auto& var : vars )
+				out.emplace_back( ctracer.rtrace( var ) );
+		} );
+	}
+	for ( auto& thread : threads )
+		thread.join();
+
+	for ( auto& out : results )
+	{
+		DOCTEST_REQUIRE( out.size() == expected.size() );
+		for ( size_t n = 0; n != out.size(); n++ )
+			CHECK( out[ n ]->equals( *expected[ n ] ) );
+	}
+}
+
+DOCTEST_TEST_CASE("Cached tracer invalidation")
+{
+	auto rtn = fixtures::make_loop();
+	auto* loop = rtn->explored_blocks.at( 0x2000 );
+	auto* exit = rtn->explored_blocks.at( 0x3000 );
+	symbolic::variable var = { std::prev( exit->end() ), r0 };
+
+	tracer ptracer = {};
+	cached_tracer ctracer = {};
+	CHECK( ctracer.rtrace( var )->equals( *ptracer.rtrace( var ) ) );
+	CHECK( ctracer.trace( var )->equals( *ptracer.trace( var ) ) );
+
+	// Modifying the block invalidates both the local and the cross-block results without
+	// a flush, and the stale entries are dropped instead of accumulating.
+	//
+	size_t entries = 0;
+	for ( uint64_t n = 0; n != 16; n++ )
+	{
+		auto it = exit->insert( var.at, { &ins::mov, { r0, operand( n, 64 ) } } );
+		symbolic::variable prev = { it, r0 };
+		CHECK( ctracer.trace( prev )->equals( *ptracer.trace( prev ) ) );
+		auto local = ctracer.trace( var );
+		CHECK( local->equals( *ptracer.trace( var ) ) );
+		CHECK( local->get<uint64_t>() == n );
+		CHECK( ctracer.rtrace( var )->equals( *ptracer.rtrace( var ) ) );
+
+		if ( !n ) entries = ctracer.size();
+		else      CHECK( ctracer.size() <= entries );
+	}
+
+	// Caches of deleted blocks are pruned on the next trace.
+	//
+	const basic_block* deleted = exit;
+	loop->next.erase( std::find( loop->next.begin(), loop->next.end(), exit ) );
+	rtn->delete_block( exit );
+	symbolic::variable other = { loop->end(), r1 };
+	CHECK( ctracer.rtrace( other )->equals( *ptracer.rtrace( other ) ) );
+	ctracer.enumerate( [ & ] ( const symbolic::variable& var, auto& )
+	{
+		CHECK( var.at.block != deleted );
+	} );
+}
+
+// Cached tracer counting the path summaries it served.
+//
+struct summary_counter : cached_tracer
+{
+	size_t hits = 0;
+	std::optional<symbolic::expression::reference> find_summary( const symbolic::variable& lookup ) override
+	{
+		auto result = cached_tracer::find_summary( lookup );
+		hits += result.has_value();
+		return result;
+	}
+};
+
+DOCTEST_TEST_CASE("Path summaries")
+{
+	for ( auto& rtn : { fixtures::make_diamond(), fixtures::make_loop() } )
+	{
+		tracer ptracer = {};
+		summary_counter ctracer = {};
+
+		// Memoized results must match the primitive tracer, including the ones composed
+		// from the summaries saved by the earlier traces.
+		//
+		auto check = [ & ]
+		{
+			for ( int pass = 0; pass != 2; pass++ )
+				for ( auto& var : variables_of( rtn.get() ) )
+					CHECK( same( ctracer.rtrace( var ), ptracer.rtrace( var ) ) );
+		};
+		check();
+		CHECK( ctracer.hits != 0 );
+
+		// Summaries are invalidated when any block in the routine is modified.
+		//
+		for ( auto& [vip, blk] : rtn->explored_blocks )
+		{
+			blk->insert( std::prev( blk->end() ), { &ins::mov, { r1, operand( vip, 64 ) } } );
+			check();
+		}
+	}
+}
+
+DOCTEST_TEST_CASE("Batch tracing")
+{
+	for ( auto& rtn : { fixtures::make_diamond(), fixtures::make_loop() } )
+	{
+		// Variables at every instruction of every block, interleaved across the blocks.
+		//
+		std::vector<symbolic::variable> lookups = variables_of( rtn.get() );
+		for ( auto& [vip, blk] : rtn->explored_blocks )
+			for ( auto it = blk->begin(); !it.is_end(); ++it )
+				for ( auto& reg : { r0, r1, r2 } )
+					lookups.emplace_back( it, reg );
+		std::reverse( lookups.begin(), lookups.begin() + lookups.size() / 2 );
+
+		tracer ptracer = {};
+		cached_tracer ctracer = {};
+		auto results = ptracer.trace_all( lookups );
+		auto cresults = ctracer.trace_all( lookups );
+		DOCTEST_REQUIRE( results.size() == lookups.size() );
+		DOCTEST_REQUIRE( cresults.size() == lookups.size() );
+		for ( size_t n = 0; n != lookups.size(); n++ )
+		{
+			auto expected = ptracer.trace( lookups[ n ] );
+			CHECK( same( results[ n ], expected ) );
+			CHECK( same( cresults[ n ], expected ) );
+		}
+	}
+}
+
+// Tracer that does not alter the results, but is not known to be pure.
+//
+struct opaque_tracer : tracer {};
+
+// Compares two access details.
+//
+static bool same_access( const symbolic::access_details& a, const symbolic::access_details& b )
+{
+	return a.bit_offset == b.bit_offset && a.bit_count == b.bit_count &&
+		a.read == b.read && a.write == b.write && a.unknown == b.unknown;
+}
+
+DOCTEST_TEST_CASE("Memory operand cache")
+{
+	CHECK( tracer{}.is_pure() );
+	CHECK( cached_tracer{}.is_pure() );
+	CHECK( !opaque_tracer{}.is_pure() );
+
+	register_desc r5 = { register_virtual, 5, 64 };
+	auto* blk = basic_block::begin( 0x1000 );
+	std::unique_ptr<routine> rtn{ blk->owner };
+	blk->mov( r5, REG_SP )->str( r5, -8, r0 )->ldd( r1, r5, -8 )->str( r5, 8, r1 )->vexit( 0ull );
+	auto sp = symbolic::variable{ blk->begin(), REG_SP }.to_expression();
+
+	// Accesses resolved through the pointers cached on the instructions must match the
+	// ones resolved by a tracer bypassing the cache, both before and after a modification.
+	//
+	auto check = [ & ]
+	{
+		cached_tracer ctracer = {};
+		opaque_tracer otracer = {};
+		for ( int64_t offset : { -16, -8, 0, 8 } )
+		{
+			for ( auto it = blk->begin(); !it.is_end(); ++it )
+			{
+				symbolic::variable var = { it, symbolic::variable::memory_t{ symbolic::pointer{ sp + offset }, 64 } };
+				for ( bool xblock : { false, true } )
+				{
+					auto expected = var.accessed_by( it, &otracer, xblock );
+					for ( int pass = 0; pass != 2; pass++ )
+						CHECK( same_access( var.accessed_by( it, &ctracer, xblock ), expected ) );
+				}
+			}
+		}
+	};
+	check();
+	blk->insert( std::next( blk->begin() ), { &ins::add, { r5, operand( 8ull, 64 ) } } );
+	check();
+}
+
+DOCTEST_TEST_CASE("Trace statistics")
+{
+	auto rtn = fixtures::make_loop();
+	auto* exit = rtn->explored_blocks.at( 0x3000 );
+	symbolic::variable var = { exit->end(), r0 };
+
+	trace_statistics stats = {};
+	stats.count( trace_statistics::cache_hits, 3 );
+	stats.count( trace_statistics::cache_misses );
+	stats.record_depth( 2 );
+	stats.record_depth( 1000 );
+	stats.record_trace( var );
+	stats.record_trace( var );
+	CHECK( stats.counters[ trace_statistics::cache_hits ] == 3 );
+	CHECK( stats.depth_histogram[ trace_statistics::depth_bucket_count - 1 ] == 1 );
+
+	// Dumped as a single object with the hottest entries listed by their counts.
+	//
+	std::string json = stats.to_json();
+	CHECK( json.front() == '{' );
+	CHECK( json.back() == '}' );
+	CHECK( json.find( "\"cache_hits\":3," ) != std::string::npos );
+	CHECK( json.find( "\"cache_misses\":1," ) != std::string::npos );
+	CHECK( json.find( "\"count\":2}" ) != std::string::npos );
+	CHECK( json.find( "\"name\":\"0x3000\"" ) != std::string::npos );
+
+	stats.reset();
+	CHECK( stats.counters[ trace_statistics::cache_hits ] == 0 );
+	CHECK( stats.depth_histogram[ 2 ] == 0 );
+	CHECK( stats.to_json().find( "\"hot_variables\":[]" ) != std::string::npos );
+
+#if VTIL_OPT_TRACE_STATISTICS
+	// Tracing is recorded by the global instance if compiled in.
+	//
+	auto& global = trace_statistics::global();
+	global.reset();
+	cached_tracer ctracer = {};
+	ctracer.rtrace( var );
+	ctracer.rtrace( var );
+	CHECK( global.counters[ trace_statistics::rtrace_calls ] != 0 );
+	CHECK( global.counters[ trace_statistics::cache_hits ] != 0 );
+#endif
+}
+
+DOCTEST_TEST_CASE("Trace budgets")
+{
+	// Values in the diamond are folded into constants, so only the loop exceeds the depth limit.
+	//
+	for ( bool loop : { false, true } )
+	{
+		auto rtn = loop ? fixtures::make_loop() : fixtures::make_diamond();
+		auto vars = variables_of( rtn.get() );
+		tracer ptracer = {};
+
+		// Each limit is accounted separately, results of exhausted calls must not be cached
+		// or memoized by the tracer nor the instructions.
+		//
+		for ( size_t limit = 0; limit != trace_budget::limit_max; limit++ )
+		{
+			cached_tracer ctracer = {};
+			switch ( limit )
+			{
+				case trace_budget::blocks: ctracer.budget.max_blocks = 1;                    break;
+				case trace_budget::depth:  ctracer.budget.max_depth = 1;                     break;
+				case trace_budget::time:   ctracer.budget.max_time = time::nanoseconds{ 1 }; break;
+			}
+			CHECK( ctracer.budget.is_bounded() );
+
+			for ( auto& var : vars )
+				ctracer.rtrace( var );
+			INFO( limit );
+			if ( loop || limit != trace_budget::depth )
+				CHECK( ctracer.budget_hits[ limit ] != 0 );
+			for ( size_t other = 0; other != trace_budget::limit_max; other++ )
+				if ( other != limit )
+					CHECK( ctracer.budget_hits[ other ] == 0 );
+
+			ctracer.budget = {};
+			for ( auto& var : vars )
+				CHECK( same( ctracer.rtrace( var ), ptracer.rtrace( var ) ) );
+		}
+	}
+}
+
+DOCTEST_TEST_CASE("Parallel path exploration")
+{
+	for ( auto& rtn : { fixtures::make_diamond(), fixtures::make_loop() } )
+	{
+		auto vars = variables_of( rtn.get() );
+
+		// Forked paths are merged in the original order, so the results match the serial ones.
+		//
+		tracer ptracer = {};
+		cached_tracer ctracer = {};
+		ctracer.parallel_paths = 2;
+		for ( auto& var : vars )
+			CHECK( same( ctracer.rtrace( var ), ptracer.rtrace( var ) ) );
+
+		// The block budget is split deterministically between the forked paths.
+		//
+		for ( size_t max_blocks : { 1, 2, 3, 5 } )
+		{
+			std::vector<symbolic::expression::reference> expected;
+			for ( int run = 0; run != 4; run++ )
+			{
+				cached_tracer btracer = {};
+				btracer.parallel_paths = 2;
+				btracer.budget.max_blocks = max_blocks;
+				for ( size_t n = 0; n != vars.size(); n++ )
+				{
+					auto result = btracer.rtrace( vars[ n ] );
+					if ( !run ) expected.emplace_back( result );
+					else        CHECK( same( result, expected[ n ] ) );
+				}
+			}
+		}
+	}
+}
+
+DOCTEST_TEST_CASE("Variable interning")
+{
+	auto rtn = fixtures::make_loop();
+	auto vars = variables_of( rtn.get() );
+
+	// Identifiers are equal exactly when the variables are, and map back to them.
+	//
+	symbolic::variable_interner interner = {};
+	std::vector<symbolic::variable_id> ids;
+	for ( auto& var : vars )
+		ids.emplace_back( interner.intern( var ) );
+	CHECK( interner.size() == vars.size() );
+	for ( size_t i = 0; i != vars.size(); i++ )
+	{
+		CHECK( interner.intern( vars[ i ] ) == ids[ i ] );
+		CHECK( interner.find( vars[ i ] ) == ids[ i ] );
+		CHECK( interner.make_id( symbolic::variable_interner::index_of( ids[ i ] ) ) == ids[ i ] );
+		CHECK( interner.resolve( ids[ i ] ) == vars[ i ] );
+		for ( size_t j = 0; j != i; j++ )
+			CHECK( ids[ i ] != ids[ j ] );
+	}
+
+	// Copies resolve the same identifiers into their own storage.
+	//
+	symbolic::variable_interner copy = interner;
+	for ( size_t i = 0; i != vars.size(); i++ )
+	{
+		CHECK( &copy.resolve( ids[ i ] ) != &interner.resolve( ids[ i ] ) );
+		CHECK( copy.resolve( ids[ i ] ) == vars[ i ] );
+	}
+
+	// Identifiers issued before a reset are no longer valid nor reissued.
+	//
+	interner.reset();
+	CHECK( interner.size() == 0 );
+	CHECK( !interner.find( vars[ 0 ] ) );
+	CHECK( !interner.contains( ids[ 0 ] ) );
+	CHECK( interner.intern( vars[ 0 ] ) != ids[ 0 ] );
+}